@@ -0,0 +1,168 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "address_index.h"
+#include "object_store.h"
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+static const char *kKindNames[] = { "sorted", "paged", "flat", "sparse" };
+
+bool AddressIndex::parse_kind(const char *name, Kind &kind) {
+  for (int i = 0; i < kNumKinds; ++i) {
+    if (strcmp(name, kKindNames[i]) == 0) {
+      kind = (Kind) i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char * AddressIndex::kind_name(Kind kind) {
+  return kKindNames[kind];
+}
+
+AddressIndex::AddressIndex(Kind kind)
+  : kind_(kind), size_(0), page_mask_(0), slot_mask_(0) {}
+
+// Smallest power of two that keeps the table at most half full.
+static uint64_t table_size(size_t n) {
+  uint64_t size = 16;
+  while (size < n * 2) {
+    size *= 2;
+  }
+  return size;
+}
+
+void AddressIndex::build(const ObjectStore &store, const std::function<void(uint32_t)> &superseded) {
+  std::vector<std::pair<uint64_t, uint32_t>> objs;
+  uint32_t n = store.get_num_objects();
+  objs.reserve(n);
+  for (uint32_t i = 1; i <= n; ++i) {
+    // Address 0 is never a real object, and marks empty slots in kFlat.
+    if (store.get_addr(i) && (store.get_flags(i) & RUBY_T_MASK) != RUBY_T_ROOT) {
+      objs.push_back(std::make_pair(store.get_addr(i), i));
+    }
+  }
+
+  switch (kind_) {
+    case kSorted:
+      build_sorted(objs, superseded);
+      break;
+    case kPaged:
+      build_sorted(objs, superseded);
+      build_pages();
+      break;
+    case kFlat:
+      build_flat(objs, superseded);
+      break;
+    default:
+      build_sparse(objs, superseded);
+      break;
+  }
+}
+
+void AddressIndex::build_sorted(std::vector<std::pair<uint64_t, uint32_t>> &objs,
+    const std::function<void(uint32_t)> &superseded) {
+  // Dumps list objects page by page, so this is usually close to sorted
+  // already.
+  if (!std::is_sorted(objs.begin(), objs.end())) {
+    std::sort(objs.begin(), objs.end());
+  }
+
+  addrs_.clear();
+  indices_.clear();
+  addrs_.reserve(objs.size());
+  indices_.reserve(objs.size());
+  for (size_t i = 0; i < objs.size(); ++i) {
+    if (i + 1 < objs.size() && objs[i + 1].first == objs[i].first) {
+      superseded(objs[i].second);
+      continue;
+    }
+    addrs_.push_back(objs[i].first);
+    indices_.push_back(objs[i].second);
+  }
+  size_ = addrs_.size();
+}
+
+void AddressIndex::build_pages() {
+  size_t num_pages = 0;
+  for (size_t i = 0; i < addrs_.size(); ++i) {
+    if (i == 0 || addrs_[i] >> kPageShift != addrs_[i - 1] >> kPageShift) {
+      num_pages++;
+    }
+  }
+
+  Page empty = { 0, 0, 0 };
+  pages_.assign(table_size(num_pages), empty);
+  page_mask_ = pages_.size() - 1;
+
+  for (size_t begin = 0, end; begin < addrs_.size(); begin = end) {
+    uint64_t page = addrs_[begin] >> kPageShift;
+    for (end = begin + 1; end < addrs_.size() && addrs_[end] >> kPageShift == page; ++end);
+
+    uint64_t i = hash(page) >> 32 & page_mask_;
+    while (pages_[i].begin != pages_[i].end) {
+      i = (i + 1) & page_mask_;
+    }
+    pages_[i].page = page;
+    pages_[i].begin = begin;
+    pages_[i].end = end;
+  }
+}
+
+void AddressIndex::build_flat(const std::vector<std::pair<uint64_t, uint32_t>> &objs,
+    const std::function<void(uint32_t)> &superseded) {
+  Slot empty = { 0, 0 };
+  slots_.assign(table_size(objs.size()), empty);
+  slot_mask_ = slots_.size() - 1;
+  size_ = 0;
+
+  for (auto &obj : objs) {
+    uint64_t i = hash(obj.first) >> 32 & slot_mask_;
+    while (slots_[i].addr != 0 && slots_[i].addr != obj.first) {
+      i = (i + 1) & slot_mask_;
+    }
+    if (slots_[i].addr == obj.first) {
+      superseded(slots_[i].idx);
+    } else {
+      size_++;
+    }
+    slots_[i].addr = obj.first;
+    slots_[i].idx = obj.second;
+  }
+}
+
+void AddressIndex::build_sparse(const std::vector<std::pair<uint64_t, uint32_t>> &objs,
+    const std::function<void(uint32_t)> &superseded) {
+  map_.clear();
+  map_.resize(objs.size());
+  for (auto &obj : objs) {
+    auto it = map_.insert(obj);
+    if (!it.second) {
+      superseded(it.first->second);
+      it.first->second = obj.second;
+    }
+  }
+  size_ = map_.size();
+}
+
+size_t AddressIndex::memory_usage() const {
+  switch (kind_) {
+    case kSorted:
+      return addrs_.capacity() * sizeof(uint64_t) + indices_.capacity() * sizeof(uint32_t);
+    case kPaged:
+      return addrs_.capacity() * sizeof(uint64_t) + indices_.capacity() * sizeof(uint32_t) +
+        pages_.capacity() * sizeof(Page);
+    case kFlat:
+      return slots_.capacity() * sizeof(Slot);
+    default:
+      // Roughly: the entries themselves plus sparsetable's per-group bitmap
+      // and pointer.
+      return map_.size() * sizeof(std::pair<uint64_t, uint32_t>) + map_.bucket_count() / 48 * 16;
+  }
+}
+
+}
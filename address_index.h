@@ -0,0 +1,188 @@
+#ifndef HARB_ADDRESS_INDEX_H
+#define HARB_ADDRESS_INDEX_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <functional>
+#include <vector>
+
+#include "sparsehash/sparse_hash_map"
+
+namespace harb {
+
+class ObjectStore;
+
+// Maps heap addresses to node indices. Lookups happen once per reference
+// while resolving a dump, so there are a few implementations to pick from:
+//
+//   sorted  addresses sorted once, branchless binary search
+//   paged   sorted addresses bucketed by 64KB heap page, then interpolation
+//           search within the page (slots in a page are evenly spaced)
+//   flat    open addressing hash table with linear probing
+//   sparse  google::sparse_hash_map, compact but slow
+class AddressIndex {
+public:
+  enum Kind {
+    kSorted = 0,
+    kPaged,
+    kFlat,
+    kSparse,
+    kNumKinds
+  };
+
+  static const Kind kDefault = kPaged;
+
+  // Returns false if name isn't one of the names above.
+  static bool parse_kind(const char *name, Kind &kind);
+  static const char * kind_name(Kind kind);
+
+  AddressIndex(Kind kind = kDefault);
+
+  AddressIndex(const AddressIndex &) = delete;
+  AddressIndex & operator=(const AddressIndex &) = delete;
+
+  Kind get_kind() const { return kind_; }
+
+  // Indexes every object in store that has an address.
+  // When an address appears more than once the object with the highest
+  // index wins and superseded is called with each of the others.
+  void build(const ObjectStore &store, const std::function<void(uint32_t)> &superseded);
+
+  // Number of addresses indexed.
+  size_t size() const { return size_; }
+
+  // Bytes used by the index.
+  size_t memory_usage() const;
+
+  // Returns the node index for addr, or 0 if it isn't in the index.
+  uint32_t find(uint64_t addr) const {
+    switch (kind_) {
+      case kSorted:
+        return find_sorted(addr);
+      case kPaged:
+        return find_paged(addr);
+      case kFlat:
+        return find_flat(addr);
+      default:
+        return find_sparse(addr);
+    }
+  }
+
+private:
+  static const int kPageShift = 16;
+
+  struct Page {
+    uint64_t page;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  struct Slot {
+    uint64_t addr;
+    uint32_t idx;
+  };
+
+  Kind kind_;
+  size_t size_;
+
+  // kSorted and kPaged
+  std::vector<uint64_t> addrs_;
+  std::vector<uint32_t> indices_;
+
+  // kPaged, a flat hash table keyed on page number
+  std::vector<Page> pages_;
+  uint64_t page_mask_;
+
+  // kFlat
+  std::vector<Slot> slots_;
+  uint64_t slot_mask_;
+
+  // kSparse
+  google::sparse_hash_map<uint64_t, uint32_t> map_;
+
+  static uint64_t hash(uint64_t key) { return key * 0x9e3779b97f4a7c15ULL; }
+
+  void build_sorted(std::vector<std::pair<uint64_t, uint32_t>> &objs,
+      const std::function<void(uint32_t)> &superseded);
+  void build_pages();
+  void build_flat(const std::vector<std::pair<uint64_t, uint32_t>> &objs,
+      const std::function<void(uint32_t)> &superseded);
+  void build_sparse(const std::vector<std::pair<uint64_t, uint32_t>> &objs,
+      const std::function<void(uint32_t)> &superseded);
+
+  uint32_t find_sorted(uint64_t addr) const {
+    return find_in(addr, 0, addrs_.size());
+  }
+
+  // Branchless binary search over [begin, end); the comparison compiles to
+  // a conditional move, so there are no mispredicted branches.
+  uint32_t find_in(uint64_t addr, size_t begin, size_t end) const {
+    size_t n = end - begin;
+    if (n == 0) {
+      return 0;
+    }
+    const uint64_t *base = addrs_.data() + begin;
+    while (n > 1) {
+      size_t half = n / 2;
+      base = base[half] <= addr ? base + half : base;
+      n -= half;
+    }
+    return *base == addr ? indices_[base - addrs_.data()] : 0;
+  }
+
+  uint32_t find_paged(uint64_t addr) const {
+    uint64_t page = addr >> kPageShift;
+    for (uint64_t i = hash(page) >> 32 & page_mask_; ; i = (i + 1) & page_mask_) {
+      const Page &p = pages_[i];
+      if (p.begin == p.end) {
+        return 0;
+      } else if (p.page == page) {
+        return find_in_page(addr, p.begin, p.end);
+      }
+    }
+  }
+
+  uint32_t find_in_page(uint64_t addr, size_t begin, size_t end) const {
+    const uint64_t *a = addrs_.data();
+    uint64_t lo = a[begin], hi = a[end - 1];
+    if (addr < lo || addr > hi) {
+      return 0;
+    }
+
+    // Guess from the address's position between the first and last object
+    // on the page, then walk to it; the guess is exact when the page is
+    // fully populated.
+    size_t i = begin;
+    if (hi > lo) {
+      i += (addr - lo) * (end - 1 - begin) / (hi - lo);
+    }
+    while (a[i] < addr) {
+      i++;
+    }
+    while (a[i] > addr) {
+      i--;
+    }
+    return a[i] == addr ? indices_[i] : 0;
+  }
+
+  uint32_t find_flat(uint64_t addr) const {
+    for (uint64_t i = hash(addr) >> 32 & slot_mask_; ; i = (i + 1) & slot_mask_) {
+      const Slot &s = slots_[i];
+      if (s.addr == addr) {
+        return s.idx;
+      } else if (s.addr == 0) {
+        return 0;
+      }
+    }
+  }
+
+  uint32_t find_sparse(uint64_t addr) const {
+    auto it = map_.find(addr);
+    return it == map_.end() ? 0 : it->second;
+  }
+};
+
+}
+
+#endif // HARB_ADDRESS_INDEX_H
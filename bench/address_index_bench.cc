@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <locale.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "address_index.h"
+#include "object_store.h"
+#include "parser.h"
+
+using namespace harb;
+
+// Parses a dump, then resolves every class and reference address in it
+// against each kind of address index, both in dump order (what resolving
+// references does) and shuffled.
+
+static double
+seconds_since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+static double
+run(const AddressIndex &index, const std::vector<uint64_t> &addrs, int iterations, size_t &found) {
+  double best = 0;
+  for (int i = 0; i < iterations; ++i) {
+    found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto addr : addrs) {
+      found += index.find(addr) != 0;
+    }
+    double t = seconds_since(start);
+    if (i == 0 || t < best) {
+      best = t;
+    }
+  }
+  return best;
+}
+
+int
+main(int argc, char **argv) {
+  setlocale(LC_ALL, "");
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <heap_dump_file> [iterations]\n", argv[0]);
+    return -1;
+  }
+
+  FILE *f = fopen(argv[1], "r");
+  if (!f) {
+    fprintf(stderr, "unable to open %s: %d\n", argv[1], errno);
+    return -1;
+  }
+  int iterations = argc > 2 ? atoi(argv[2]) : 3;
+
+  ObjectStore store;
+  Parser parser(f, &store);
+  parser.parse([] (RubyHeapObj) {});
+
+  std::vector<uint64_t> addrs;
+  for (size_t i = 0; i < store.get_class_addrs().size(); ++i) {
+    if (store.get_class_addrs()[i]) {
+      addrs.push_back(store.get_class_addrs()[i]);
+    }
+  }
+  addrs.insert(addrs.end(), store.get_ref_addrs().data(),
+      store.get_ref_addrs().data() + store.get_ref_addrs().size());
+  std::vector<uint64_t> shuffled(addrs);
+  std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937_64(42));
+
+  printf("%'u objects, %'zu lookups\n", store.get_num_objects(), addrs.size());
+  for (int k = 0; k < AddressIndex::kNumKinds; ++k) {
+    AddressIndex index((AddressIndex::Kind) k);
+
+    auto start = std::chrono::steady_clock::now();
+    index.build(store, [] (uint32_t) {});
+    double build = seconds_since(start);
+
+    size_t found;
+    double ordered = run(index, addrs, iterations, found);
+    double random = run(index, shuffled, iterations, found);
+    printf("%8s: build %.3fs, %'7.1f MB, in order %'6.1f M/s, shuffled %'6.1f M/s (%'zu found)\n",
+        AddressIndex::kind_name((AddressIndex::Kind) k), build,
+        index.memory_usage() / (1024.0 * 1024), addrs.size() / ordered / 1e6,
+        addrs.size() / random / 1e6, found);
+  }
+
+  fclose(f);
+  return 0;
+}
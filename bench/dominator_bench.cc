@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <locale.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+
+#include "address_index.h"
+#include "dominator_tree.h"
+#include "object_store.h"
+#include "parser.h"
+
+using namespace harb;
+
+// Loads a dump the way Graph does and times calculating its dominator tree
+// with each algorithm (or just the one given with -d), checking that they
+// all produce the same tree. The parallel algorithm is run with 1 to 32
+// threads and its speedup over one thread reported. With -c, the dump is a
+// synthetic linked list of the given length instead, which is the worst
+// case for anything that recurses per object, and every algorithm must give
+// each node the one before it as its immediate dominator. Exits non-zero if
+// any tree is wrong.
+
+static double
+seconds_since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+static const char *kUsage = "usage: %s [-d algorithm] [-c chain_length | <heap_dump_file>] [iterations]\n";
+
+static FILE *
+write_chain(uint64_t length) {
+  FILE *f = tmpfile();
+  if (!f) {
+    return NULL;
+  }
+
+  const uint64_t base = 0x7f0000000000ULL;
+  fprintf(f, "{\"type\":\"ROOT\", \"root\":\"vm\", \"references\":[\"0x%" PRIx64 "\"]}\n", base);
+  for (uint64_t i = 0; i < length; ++i) {
+    fprintf(f, "{\"address\":\"0x%" PRIx64 "\", \"type\":\"OBJECT\", \"memsize\":40", base + i * 40);
+    if (i + 1 < length) {
+      fprintf(f, ", \"references\":[\"0x%" PRIx64 "\"]", base + (i + 1) * 40);
+    }
+    fprintf(f, "}\n");
+  }
+  fflush(f);
+  rewind(f);
+  return f;
+}
+
+// The chain's nodes are the synthetic root, the ROOT object and then the
+// list in order, so each one is dominated by the node before it.
+static bool
+check_chain(DominatorTree::Algorithm algorithm, int32_t num_reachable, const std::vector<uint32_t> &idom) {
+  uint32_t n = idom.size() - 1;
+  if ((uint32_t) num_reachable != n) {
+    printf("%8s: %'d of %'u nodes reachable\n", DominatorTree::algorithm_name(algorithm), num_reachable, n);
+    return false;
+  }
+  for (uint32_t i = 2; i <= n; ++i) {
+    if (idom[i] != i - 1) {
+      printf("%8s: idom(%u) is %u, not %u\n", DominatorTree::algorithm_name(algorithm), i, idom[i], i - 1);
+      return false;
+    }
+  }
+  return true;
+}
+
+int
+main(int argc, char **argv) {
+  setlocale(LC_ALL, "");
+
+  uint64_t chain = 0;
+  int only = -1;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:d:")) != -1) {
+    switch (opt) {
+      case 'c':
+        chain = strtoull(optarg, NULL, 10);
+        break;
+      case 'd': {
+        DominatorTree::Algorithm algorithm;
+        if (!DominatorTree::parse_algorithm(optarg, algorithm)) {
+          fprintf(stderr, "unknown dominator algorithm %s\n", optarg);
+          return -1;
+        }
+        only = algorithm;
+        break;
+      }
+      default:
+        fprintf(stderr, kUsage, argv[0]);
+        return -1;
+    }
+  }
+
+  FILE *f;
+  if (chain) {
+    f = write_chain(chain);
+  } else if (optind < argc) {
+    f = fopen(argv[optind++], "r");
+  } else {
+    fprintf(stderr, kUsage, argv[0]);
+    return -1;
+  }
+  if (!f) {
+    fprintf(stderr, "unable to open dump: %d\n", errno);
+    return -1;
+  }
+  int iterations = optind < argc ? atoi(argv[optind]) : 3;
+
+  ObjectStore store;
+  Parser parser(f, &store);
+  RubyHeapObj root = parser.create_heap_object(RUBY_T_ROOT);
+  store.set_root(root.get_index());
+  parser.parse([&] (RubyHeapObj obj) {
+    if (obj.is_root_object()) {
+      store.add_root_child(obj.get_index());
+    }
+  });
+
+  AddressIndex index;
+  index.build(store, [&] (uint32_t i) {
+    store.remove(i);
+  });
+  store.resolve(index);
+  store.add_inverse_references();
+
+  uint32_t n = store.get_num_objects();
+  printf("%'u objects, %'zu references\n", n, store.get_refs_to().size());
+
+  std::vector<uint32_t> expected;
+  bool mismatch = false;
+  for (int k = 0; k < DominatorTree::kNumAlgorithms; ++k) {
+    if (only >= 0 && k != only) {
+      continue;
+    }
+    DominatorTree::Algorithm algorithm = (DominatorTree::Algorithm) k;
+
+    std::vector<unsigned> thread_counts(1, 1);
+    if (algorithm == DominatorTree::kParallel) {
+      thread_counts = { 1, 2, 4, 8, 16, 32 };
+    }
+
+    double single = 0;
+    for (auto num_threads : thread_counts) {
+      double best = 0;
+      for (int i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        DominatorTree tree(root, n, algorithm);
+        tree.set_num_threads(num_threads);
+        tree.calculate();
+        double t = seconds_since(start);
+        if (i == 0 || t < best) {
+          best = t;
+        }
+
+        if (i == 0) {
+          std::vector<uint32_t> idom(n + 1, 0);
+          uint64_t checksum = 0;
+          for (int32_t j = 2; j <= tree.get_num_reachable(); ++j) {
+            RubyHeapObj obj = tree.get_dfs_node(j);
+            idom[obj.get_index()] = tree.get_idom(obj).get_index();
+            checksum = checksum * 31 + obj.get_index() * 7 + idom[obj.get_index()];
+          }
+          if (chain && !check_chain(algorithm, tree.get_num_reachable(), idom)) {
+            mismatch = true;
+          }
+          if (expected.empty()) {
+            printf("%'d reachable, root retains %'" PRIu64 " bytes, checksum %016" PRIx64 "\n",
+                tree.get_num_reachable(), tree.get_retained_size(root), checksum);
+            expected.swap(idom);
+          } else if (idom != expected) {
+            printf("%8s: checksum %016" PRIx64 " doesn't match\n",
+                DominatorTree::algorithm_name(algorithm), checksum);
+            mismatch = true;
+          }
+        }
+      }
+
+      if (thread_counts.size() == 1) {
+        printf("%8s: %.3fs\n", DominatorTree::algorithm_name(algorithm), best);
+      } else {
+        if (num_threads == 1) {
+          single = best;
+        }
+        printf("%8s: %2u threads %.3fs (%.2fx)\n", DominatorTree::algorithm_name(algorithm),
+            num_threads, best, single / best);
+      }
+    }
+  }
+
+  if (mismatch) {
+    printf(chain ? "error: wrong dominator tree for the chain\n" : "error: dominator trees differ\n");
+    return 1;
+  }
+
+  fclose(f);
+  return 0;
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <locale.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "address_index.h"
+#include "parser.h"
+#include "scan.h"
+
+using namespace harb;
+
+// Parses the same dump with the original unmapped FileReadStream parse, the
+// generic rapidjson handler over the mapping and the dump_all fast path
+// (once per available set of scan kernels) and reports throughput for each.
+// Every mode must store the same objects; the bench exits non-zero if their
+// checksums differ.
+
+// Reads the dump through a stream with no file descriptor, so the parser
+// can't map it and falls back to rapidjson's FileReadStream.
+static ssize_t
+cookie_read(void *cookie, char *buf, size_t size) {
+  return read(*(int *) cookie, buf, size);
+}
+
+static int
+cookie_seek(void *cookie, off64_t *offset, int whence) {
+  off_t result = lseek(*(int *) cookie, *offset, whence);
+  if (result < 0) {
+    return -1;
+  }
+  *offset = result;
+  return 0;
+}
+
+static uint64_t
+mix(uint64_t h, uint64_t value) {
+  return (h ^ value) * 0x100000001b3ULL;
+}
+
+static uint64_t
+mix_string(uint64_t h, const char *str) {
+  for (; str && *str; ++str) {
+    h = mix(h, (unsigned char) *str);
+  }
+  return mix(h, 0);
+}
+
+// Hashes every column the parse fills in, with references and classes
+// resolved to node indices. Strings are hashed by content, since their
+// offsets depend on the order each path interns them in.
+static uint64_t
+checksum(ObjectStore &store) {
+  AddressIndex index;
+  index.build(store, [&] (uint32_t i) {
+    store.remove(i);
+  });
+  store.resolve(index);
+
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (uint32_t i = 1; i <= store.get_num_objects(); ++i) {
+    h = mix(h, store.get_addr(i));
+    h = mix(h, store.get_flags(i));
+    h = mix(h, store.get_classes()[i]);
+    h = mix(h, store.get_memsize(i));
+    h = mix(h, store.get_size(i));
+    h = mix(h, store.get_line(i));
+    h = mix(h, store.get_generation(i));
+    h = mix_string(h, store.get_value(i));
+    h = mix_string(h, store.get_file(i));
+    h = mix_string(h, store.get_method(i));
+    for (uint64_t j = store.get_refs_to_offsets()[i]; j < store.get_refs_to_offsets()[i + 1]; ++j) {
+      h = mix(h, store.get_refs_to()[j]);
+    }
+  }
+  return h;
+}
+
+static double
+run(FILE *f, const char *mode, size_t &num_objects, uint64_t *sum) {
+  int fd = fileno(f);
+  cookie_io_functions_t io = { cookie_read, NULL, cookie_seek, NULL };
+  FILE *unmapped = strcmp(mode, "filestream") == 0 ? fopencookie(&fd, "r", io) : NULL;
+
+  ObjectStore store;
+  Parser parser(unmapped ? unmapped : f, &store);
+  parser.set_fast_path(!unmapped && strcmp(mode, "rapidjson") != 0);
+
+  num_objects = 0;
+  auto start = std::chrono::steady_clock::now();
+  parser.parse([&] (RubyHeapObj) {
+    num_objects++;
+  });
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  if (unmapped) {
+    fclose(unmapped);
+  }
+  if (sum) {
+    *sum = checksum(store);
+  }
+  return elapsed.count();
+}
+
+int
+main(int argc, char **argv) {
+  setlocale(LC_ALL, "");
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <heap_dump_file> [iterations]\n", argv[0]);
+    return -1;
+  }
+
+  FILE *f = fopen(argv[1], "r");
+  if (!f) {
+    fprintf(stderr, "unable to open %s: %d\n", argv[1], errno);
+    return -1;
+  }
+  fseeko(f, 0, SEEK_END);
+  double size = ftello(f);
+
+  int iterations = argc > 2 ? atoi(argv[2]) : 3;
+  uint64_t expected = 0;
+  bool mismatch = false;
+  const char *modes[] = { "filestream", "rapidjson", "avx2", "sse2", "scalar" };
+  for (auto mode : modes) {
+    bool fast_path = strcmp(mode, "filestream") != 0 && strcmp(mode, "rapidjson") != 0;
+    if (fast_path && !scan::select_isa(mode)) {
+      continue;
+    }
+
+    double best = 0;
+    size_t num_objects = 0;
+    uint64_t sum = 0;
+    for (int i = 0; i < iterations; ++i) {
+      double t = run(f, mode, num_objects, i == 0 ? &sum : NULL);
+      if (i == 0 || t < best) {
+        best = t;
+      }
+    }
+    printf("%10s: %'zu objects in %.3fs, %'.1f MB/s, checksum %016" PRIx64 "\n", mode, num_objects, best,
+        size / best / (1024 * 1024), sum);
+    if (strcmp(mode, "filestream") == 0) {
+      expected = sum;
+    } else if (sum != expected) {
+      printf("%10s: checksum doesn't match filestream\n", mode);
+      mismatch = true;
+    }
+  }
+
+  fclose(f);
+  if (mismatch) {
+    printf("error: parses differ\n");
+    return 1;
+  }
+  return 0;
+}
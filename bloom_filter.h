@@ -0,0 +1,70 @@
+#ifndef HARB_BLOOM_FILTER_H
+#define HARB_BLOOM_FILTER_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace harb {
+
+// A blocked Bloom filter of 64 bit keys: each key is hashed to
+// kHashesPerKey bits, all in one 64 byte block, so a lookup reads one block.
+// The filter is sized separately, at bits_per_key bits of filter per key;
+// at the default 10 about 1% of lookups for keys that were never inserted
+// say yes.
+// insert() may be called from several threads at once.
+class BloomFilter {
+public:
+  static const unsigned kHashesPerKey = 6;
+
+  // Sized for num_keys keys at bits_per_key bits of filter each.
+  BloomFilter(size_t num_keys, unsigned bits_per_key = 10)
+    : blocks_(std::max<size_t>(num_keys * bits_per_key / 512, 1) * 8, 0) {}
+
+  void insert(uint64_t key) {
+    uint64_t h = mix(key);
+    uint64_t *block = &blocks_[block_for(h)];
+    for (unsigned i = 0; i < kHashesPerKey; ++i, h >>= 9) {
+      __atomic_fetch_or(&block[(h >> 6) & 7], 1ULL << (h & 63), __ATOMIC_RELAXED);
+    }
+  }
+
+  bool maybe_contains(uint64_t key) const {
+    uint64_t h = mix(key);
+    const uint64_t *block = &blocks_[block_for(h)];
+    for (unsigned i = 0; i < kHashesPerKey; ++i, h >>= 9) {
+      if (!(block[(h >> 6) & 7] & (1ULL << (h & 63)))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  size_t memory_usage() const { return blocks_.size() * sizeof(uint64_t); }
+
+private:
+  std::vector<uint64_t> blocks_;
+
+  // Addresses are aligned and clustered, so they're mixed before use
+  // (splitmix64's finalizer).
+  static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  // The low 54 bits of h pick the bits within the block, so the block is
+  // picked by mixing h again.
+  size_t block_for(uint64_t h) const {
+    size_t num_blocks = blocks_.size() / 8;
+    return (size_t) (((unsigned __int128) mix(h) * num_blocks) >> 64) * 8;
+  }
+};
+
+}
+
+#endif // HARB_BLOOM_FILTER_H
@@ -0,0 +1,148 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+#include "sparsehash/dense_hash_map"
+
+#include "class_stats.h"
+#include "graph.h"
+#include "parallel.h"
+
+namespace harb {
+
+uint64_t ClassStats::key_for(RubyHeapObj obj) {
+  RubyValueType type = obj.get_type();
+  if (type == RUBY_T_ROOT) {
+    return 0;
+  }
+  uint32_t klass = obj.get_class_obj().get_index();
+  return klass ? klass : kTypeKey | type;
+}
+
+const char * ClassStats::key_name(ObjectStore *store, uint64_t key, char *buf, size_t buf_sz) {
+  if (key & kTypeKey) {
+    snprintf(buf, buf_sz, "(%s)", RubyHeapObj::get_value_type_string(key & ~kTypeKey));
+    return buf;
+  }
+  RubyHeapObj klass(store, key);
+  if (klass.get_value()) {
+    return klass.get_value();
+  }
+  snprintf(buf, buf_sz, "0x%" PRIx64, klass.get_addr());
+  return buf;
+}
+
+// Two passes. The first walks the dominator tree depth first, keeping a
+// count of each class on the path down, to find the instances that aren't
+// dominated by another instance of their class. Subtrees of the root are
+// independent, so threads take them largest first. The second pass splits
+// the node indices into one block per thread, each aggregating its block
+// into its own table before they're merged.
+ClassStats::ClassStats(Graph *graph, unsigned num_threads,
+    const std::function<bool(RubyHeapObj)> &matches,
+    const std::function<uint64_t(RubyHeapObj)> &key) {
+  num_threads = std::max(num_threads, 1u);
+  ObjectStore *store = &graph->store_;
+  DominatorTree *tree = graph->dominator_tree_;
+  uint32_t n = graph->num_objects_;
+
+  auto group = [&] (RubyHeapObj obj) -> uint64_t {
+    if (matches && !matches(obj)) {
+      return 0;
+    }
+    return key ? key(obj) : key_for(obj);
+  };
+
+  // Unreachable objects are only dominated by themselves.
+  std::vector<char> outermost(n + 1, 1);
+
+  const uint32_t *tops = tree->get_children(graph->root_);
+  size_t num_tops = tree->get_num_children(graph->root_);
+  std::atomic<size_t> next_top(0);
+  parallel_ranges(num_threads, num_threads, [&] (unsigned, size_t, size_t) {
+    google::dense_hash_map<uint64_t, uint32_t> active;
+    active.set_empty_key(UINT64_MAX);
+
+    // Each node and how many of its children have been visited.
+    std::vector<std::pair<uint32_t, uint32_t>> stack;
+    auto enter = [&] (uint32_t v) {
+      uint64_t k = group(RubyHeapObj(store, v));
+      if (k) {
+        outermost[v] = active[k]++ == 0;
+      }
+      stack.push_back(std::make_pair(v, 0));
+    };
+
+    for (size_t t; (t = next_top++) < num_tops;) {
+      enter(tops[t]);
+      while (!stack.empty()) {
+        RubyHeapObj v(store, stack.back().first);
+        uint32_t i = stack.back().second;
+        if (i < tree->get_num_children(v)) {
+          stack.back().second++;
+          enter(tree->get_children(v)[i]);
+        } else {
+          uint64_t k = group(v);
+          if (k) {
+            active[k]--;
+          }
+          stack.pop_back();
+        }
+      }
+    }
+  });
+
+  std::vector<google::dense_hash_map<uint64_t, Entry>> tables(num_threads);
+  for (auto &table : tables) {
+    table.set_empty_key(0);
+  }
+  parallel_ranges(n, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    google::dense_hash_map<uint64_t, Entry> &table = tables[t];
+    for (uint32_t i = lo + 1; i <= hi; ++i) {
+      if (store->is_removed(i)) {
+        continue;
+      }
+      RubyHeapObj obj(store, i);
+      uint64_t k = group(obj);
+      if (!k) {
+        continue;
+      }
+
+      auto it = table.find(k);
+      if (it == table.end()) {
+        Entry entry = { k, 0, 0, 0, i };
+        it = table.insert(std::make_pair(k, entry)).first;
+      }
+      it->second.count++;
+      it->second.memsize += obj.get_memsize();
+      if (outermost[i]) {
+        it->second.retained_size += tree->get_retained_size(obj);
+      }
+    }
+  });
+
+  google::dense_hash_map<uint64_t, size_t> positions;
+  positions.set_empty_key(0);
+  for (auto &table : tables) {
+    for (auto &it : table) {
+      auto pos = positions.find(it.first);
+      if (pos == positions.end()) {
+        positions[it.first] = entries_.size();
+        entries_.push_back(it.second);
+      } else {
+        Entry &entry = entries_[pos->second];
+        entry.count += it.second.count;
+        entry.memsize += it.second.memsize;
+        entry.retained_size += it.second.retained_size;
+      }
+    }
+  }
+
+  std::sort(entries_.begin(), entries_.end(), [] (const Entry &a, const Entry &b) {
+    return a.retained_size > b.retained_size || (a.retained_size == b.retained_size && a.key < b.key);
+  });
+}
+
+}
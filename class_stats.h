@@ -0,0 +1,59 @@
+#ifndef HARB_CLASS_STATS_H
+#define HARB_CLASS_STATS_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <functional>
+#include <vector>
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+class Graph;
+
+// Objects grouped by class: how many there are, their memsize and the
+// memory they retain. Retained memory only counts instances that no other
+// instance of the same class dominates, so nested instances (a Hash of
+// Hashes) are counted once. Objects without a class are grouped by type.
+// Other groupings (e.g. by allocation site) can be had by passing a key
+// function instead.
+class ClassStats {
+public:
+  // Keys are the class's node index, or kTypeKey | type.
+  static const uint64_t kTypeKey = 1ULL << 32;
+
+  struct Entry {
+    uint64_t key;
+    uint64_t count;
+    uint64_t memsize;
+    uint64_t retained_size;
+    // One of the objects in the group.
+    uint32_t sample;
+  };
+
+  // Aggregates every object in graph, or only those matches accepts,
+  // splitting the work over num_threads. Objects are grouped by key, or
+  // key_for if there isn't one; those keyed 0 are left out.
+  ClassStats(Graph *graph, unsigned num_threads,
+      const std::function<bool(RubyHeapObj)> &matches = nullptr,
+      const std::function<uint64_t(RubyHeapObj)> &key = nullptr);
+
+  // Largest retained size first.
+  const std::vector<Entry> & entries() const { return entries_; }
+
+  // The key obj is grouped under, 0 for roots.
+  static uint64_t key_for(RubyHeapObj obj);
+
+  // The class name for key, its address for anonymous classes or the type
+  // in parentheses.
+  static const char * key_name(ObjectStore *store, uint64_t key, char *buf, size_t buf_sz);
+
+private:
+  std::vector<Entry> entries_;
+};
+
+}
+
+#endif // HARB_CLASS_STATS_H
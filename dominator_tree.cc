@@ -1,97 +1,143 @@
+#include <string.h>
+
+#include <algorithm>
+
 #include "dominator_tree.h"
+#include "parallel.h"
 
 #define likely(x)      __builtin_expect(!!(x), 1)
 #define unlikely(x)    __builtin_expect(!!(x), 0)
 
 namespace harb {
 
-DominatorTree::DominatorTree(RubyHeapObj *root, int32_t num_nodes)
-  : root(root), num_nodes(num_nodes + 1), count(0) {
-  progress = new harb::Progress("generating dominator tree", num_nodes * 3);
-  progress->start();
-
-  arr = new int32_t[num_nodes];
-  rev = new int32_t[num_nodes];
-  label = new int32_t[num_nodes];
-  sdom = new int32_t[num_nodes];
-  dom = new int32_t[num_nodes];
-  parent = new int32_t[num_nodes];
-  dsu = new int32_t[num_nodes];
-  objs = new RubyHeapObj*[num_nodes];
-
-  reverse_graph = new std::vector<int32_t>*[num_nodes];
-  bucket = new std::vector<int32_t>*[num_nodes];
-  tree = new std::vector<int32_t>*[num_nodes];
+static const char *kAlgorithmNames[] = { "lt", "snca", "parallel" };
 
-  for (int32_t i = 0; i < this->num_nodes; ++i) {
-    reverse_graph[i] = new std::vector<int32_t>();
-    bucket[i] = new std::vector<int32_t>();
-    tree[i] = new std::vector<int32_t>();
+bool DominatorTree::parse_algorithm(const char *name, Algorithm &algorithm) {
+  for (int i = 0; i < kNumAlgorithms; ++i) {
+    if (strcmp(name, kAlgorithmNames[i]) == 0) {
+      algorithm = (Algorithm) i;
+      return true;
+    }
   }
+  return false;
 }
 
-DominatorTree::~DominatorTree() {
-  delete[] objs;
+const char * DominatorTree::algorithm_name(Algorithm algorithm) {
+  return kAlgorithmNames[algorithm];
+}
 
-  for (int32_t i = 0; i < this->num_nodes; ++i) {
-    delete tree[i];
-  }
+DominatorTree::DominatorTree(RubyHeapObj root, int32_t num_nodes, Algorithm algorithm)
+  : root(root), store(root.get_store()), num_nodes(num_nodes + 1), count(0), algorithm(algorithm),
+    num_threads(1), bucket(NULL), idoms(NULL), child_offsets(NULL), children(NULL),
+    retained_sizes(NULL), retained_counts(NULL) {
+  progress = new harb::Progress("generating dominator tree", num_nodes * 3);
+  progress->start();
 
-  delete[] tree;
+  // Node indices run from 1 to num_nodes inclusive.
+  order_buf.resize(this->num_nodes);
+  order = order_buf.data();
+
+  arr = new int32_t[this->num_nodes]();
+  rev = (int32_t *) order_buf.data();
+  label = new int32_t[this->num_nodes];
+  sdom = new int32_t[this->num_nodes];
+  dom = new int32_t[this->num_nodes];
+  parent = new int32_t[this->num_nodes];
+  dsu = new int32_t[this->num_nodes];
+  stack = new int32_t[this->num_nodes];
+}
 
+DominatorTree::DominatorTree(RubyHeapObj root, int32_t num_nodes, int32_t count,
+    const uint32_t *order, const uint32_t *idoms,
+    const uint32_t *child_offsets, const uint32_t *children,
+    const uint64_t *retained_sizes, const uint32_t *retained_counts)
+  : root(root), store(root.get_store()), num_nodes(num_nodes + 1), count(count),
+    algorithm(kDefaultAlgorithm), num_threads(1), arr(NULL), rev(NULL), label(NULL),
+    sdom(NULL), dom(NULL), parent(NULL), dsu(NULL), stack(NULL), bucket(NULL), order(order),
+    idoms(idoms), child_offsets(child_offsets), children(children), retained_sizes(retained_sizes),
+    retained_counts(retained_counts), progress(NULL) {}
+
+DominatorTree * DominatorTree::load(RubyHeapObj root, int32_t num_nodes, int32_t count,
+    const uint32_t *order, const uint32_t *idoms,
+    const uint32_t *child_offsets, const uint32_t *children,
+    const uint64_t *retained_sizes, const uint32_t *retained_counts) {
+  return new DominatorTree(root, num_nodes, count, order, idoms, child_offsets, children,
+      retained_sizes, retained_counts);
+}
+
+DominatorTree::~DominatorTree() {
   delete progress;
 }
 
-void DominatorTree::dfs_child(RubyHeapObj *obj, RubyHeapObj *child) {
-  int32_t u = obj->get_index();
-  int32_t w = child->get_index();
+// Numbers nodes in the same preorder a recursive DFS following references in
+// order would, using an explicit stack so long reference chains can't
+// overflow the native one. next[d] is how far the node at depth d has got
+// through its references.
+void DominatorTree::dfs(uint32_t r) {
+  uint64_t *next = new uint64_t[this->num_nodes];
+  int32_t depth = 0;
+
+  visit(r);
+  stack[0] = r;
+  next[0] = 0;
+  while (depth >= 0) {
+    uint32_t v = stack[depth];
+    const uint32_t *refs = store->get_refs_to(v);
+    size_t n = store->get_num_refs_to(v);
+    while (next[depth] < n && arr[refs[next[depth]]]) {
+      next[depth]++;
+    }
+    if (next[depth] == n) {
+      depth--;
+      continue;
+    }
 
-  if (!arr[w]) {
-    dfs(child);
-    parent[arr[w]] = arr[u];
+    uint32_t w = refs[next[depth]++];
+    visit(w);
+    parent[arr[w]] = arr[v];
+    stack[++depth] = w;
+    next[depth] = 0;
   }
 
-  reverse_graph[arr[w]]->push_back(arr[u]);
+  delete[] next;
 }
 
-void DominatorTree::dfs(RubyHeapObj *obj) {
+void DominatorTree::visit(uint32_t v) {
   count++;
-  arr[obj->get_index()] = count;
-  rev[count] = obj->get_index();
+  arr[v] = count;
+  rev[count] = v;
   label[count] = count;
   sdom[count] = count;
   dsu[count] = count;
-  objs[obj->get_index()] = obj;
 
   progress->increment();
-
-  if (unlikely(obj == root)) {
-    for(auto it = obj->get_root_children()->cbegin(); it != obj->get_root_children()->cend(); it++) {
-      dfs_child(obj, *it);
-    }
-  } else if(obj->has_refs_to()) {
-    for (uint32_t i = 0; obj->get_refs_to(i) != NULL; ++i) {
-      dfs_child(obj, obj->get_refs_to(i));
-    }
-  }
 }
 
-int32_t DominatorTree::find(int32_t u, int32_t x) {
+// Returns the node with the smallest semidominator on the DSU path from u
+// up to, but not including, its root, compressing the path as it goes.
+// Every node on the path is pointed at the last node below the root, whose
+// label stays untouched, and takes the smaller label of its old parent.
+int32_t DominatorTree::find(int32_t u) {
   if (u == dsu[u]) {
-    return x ? -1 : u;
+    return u;
   }
 
-  int32_t v = find(dsu[u], x + 1);
-  if (v < 0) {
-    return u;
+  int32_t n = 0;
+  int32_t w = u;
+  while (dsu[w] != dsu[dsu[w]]) {
+    stack[n++] = w;
+    w = dsu[w];
   }
 
-  if (sdom[label[dsu[u]]] < sdom[label[u]]) {
-    label[u] = label[dsu[u]];
+  while (n > 0) {
+    int32_t v = stack[--n];
+    if (sdom[label[dsu[v]]] < sdom[label[v]]) {
+      label[v] = label[dsu[v]];
+    }
+    dsu[v] = w;
   }
 
-  dsu[u] = v;
-  return x ? v : label[u];
+  return label[u];
 }
 
 void DominatorTree::_union(int32_t u, int32_t v) {
@@ -99,9 +145,18 @@ void DominatorTree::_union(int32_t u, int32_t v) {
 }
 
 void DominatorTree::calculate_sdom() {
+  bucket = new std::vector<int32_t>*[this->num_nodes];
+  for (int32_t i = 0; i < this->num_nodes; ++i) {
+    bucket[i] = new std::vector<int32_t>();
+  }
+
   for (int32_t i = count; i >= 1; i--) {
-    for (uint32_t j = 0; j < reverse_graph[i]->size(); j++) {
-      sdom[i] = std::min(sdom[i], sdom[find((*reverse_graph[i])[j])]);
+    // Predecessors that weren't reached by the DFS don't count.
+    const uint32_t *preds = store->get_refs_from(rev[i]);
+    for (size_t j = 0, n = store->get_num_refs_from(rev[i]); j < n; j++) {
+      if (arr[preds[j]]) {
+        sdom[i] = std::min(sdom[i], sdom[find(arr[preds[j]])]);
+      }
     }
 
     if (i > 1) {
@@ -125,64 +180,216 @@ void DominatorTree::calculate_sdom() {
 
     progress->increment();
   }
+
+  for (int32_t i = 2; i <= count; i++) {
+    if (dom[i] != sdom[i]) {
+      dom[i] = dom[dom[i]];
+    }
+  }
+}
+
+// Semi-NCA: semidominators are found the same way as above, but without
+// buckets. Each node's idom is then the nearest common ancestor of its
+// parent and its semidominator in the dominator tree built so far, which
+// walking up idoms from the parent until at or above the semidominator
+// finds, since nodes are visited in preorder.
+void DominatorTree::calculate_snca() {
+  for (int32_t i = count; i >= 2; i--) {
+    const uint32_t *preds = store->get_refs_from(rev[i]);
+    for (size_t j = 0, n = store->get_num_refs_from(rev[i]); j < n; j++) {
+      if (arr[preds[j]]) {
+        sdom[i] = std::min(sdom[i], sdom[find(arr[preds[j]])]);
+      }
+    }
+
+    _union(parent[i], i);
+
+    progress->increment();
+  }
+
+  dom[1] = 1;
+  for (int32_t i = 2; i <= count; i++) {
+    int32_t d = parent[i];
+    while (d > sdom[i]) {
+      d = dom[d];
+    }
+    dom[i] = d;
+  }
+}
+
+// Other threads read and write dom while this one does, so every access
+// in the parallel engine is atomic.
+static inline int32_t load_dom(int32_t *dom, int32_t i) {
+  return __atomic_load_n(&dom[i], __ATOMIC_RELAXED);
+}
+
+// Nearest common ancestor of a and b in the tree dom describes so far.
+// Every node's dom is numbered lower than it, so walking up from whichever
+// is numbered higher meets at or before the root.
+static inline int32_t intersect(int32_t *dom, int32_t a, int32_t b) {
+  while (a != b) {
+    while (a > b) {
+      a = load_dom(dom, a);
+    }
+    while (b > a) {
+      b = load_dom(dom, b);
+    }
+  }
+  return a;
+}
+
+// Cooper, Harvey and Kennedy's iterative algorithm: each node's idom is the
+// nearest common ancestor of its predecessors that have one so far,
+// repeated until nothing changes. Nodes start out with no idom (0) and are
+// only given one once their DFS parent has, starting from it, so a node's
+// idom is always numbered lower than it. The answer doesn't depend on the
+// order nodes are updated in, so each thread takes a contiguous block of the
+// preorder and updates it while the others update theirs. A round in which
+// no thread changed anything, or skipped a node, means it has settled.
+void DominatorTree::calculate_parallel() {
+  for (int32_t i = 2; i <= count; i++) {
+    dom[i] = 0;
+  }
+  dom[1] = 1;
+
+  bool changed = true;
+  while (changed) {
+    std::vector<char> thread_changed(num_threads, 0);
+    parallel_ranges(count - 1, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+      bool c = false;
+      for (int32_t i = lo + 2; i < (int32_t) hi + 2; i++) {
+        int32_t d = parent[i];
+        if (!load_dom(dom, d)) {
+          c = true;
+          continue;
+        }
+
+        const uint32_t *preds = store->get_refs_from(rev[i]);
+        for (size_t j = 0, n = store->get_num_refs_from(rev[i]); j < n; j++) {
+          int32_t p = arr[preds[j]];
+          if (p && load_dom(dom, p)) {
+            d = intersect(dom, d, p);
+          }
+        }
+        if (d != load_dom(dom, i)) {
+          __atomic_store_n(&dom[i], d, __ATOMIC_RELAXED);
+          c = true;
+        }
+      }
+      thread_changed[t] = c;
+    });
+
+    changed = false;
+    for (unsigned t = 0; t < num_threads; ++t) {
+      changed = changed || thread_changed[t];
+    }
+  }
 }
 
 void DominatorTree::cleanup_intermediate_state() {
   delete[] arr;
-  delete[] rev;
   delete[] label;
   delete[] sdom;
+  delete[] dom;
   delete[] parent;
   delete[] dsu;
+  delete[] stack;
 
-  for (int32_t i = 0; i < this->num_nodes; ++i) {
-    delete reverse_graph[i];
-    delete bucket[i];
+  if (bucket) {
+    for (int32_t i = 0; i < this->num_nodes; ++i) {
+      delete bucket[i];
+    }
+    delete[] bucket;
   }
-  delete[] reverse_graph;
-  delete[] bucket;
 }
 
 void DominatorTree::calculate() {
   progress->start();
 
-  dfs(root);
+  dfs(root.get_index());
 
   progress->update(num_nodes);
 
-  calculate_sdom();
+  if (algorithm == kSemiNCA) {
+    calculate_snca();
+  } else if (algorithm == kParallel) {
+    calculate_parallel();
+  } else {
+    calculate_sdom();
+  }
 
   progress->update(num_nodes * 2);
 
+  idom_buf.assign(num_nodes, 0);
   for (int32_t i = 2; i <= count; i++) {
-    if (dom[i] != sdom[i]) {
-      dom[i] = dom[dom[i]];
-    }
-
-    tree[rev[i]]->push_back(rev[dom[i]]);
-    tree[rev[dom[i]]]->push_back(rev[i]);
+    idom_buf[rev[i]] = rev[dom[i]];
     progress->increment();
   }
+  idoms = idom_buf.data();
 
   cleanup_intermediate_state();
+  order_buf.resize(count + 1);
+  order = order_buf.data();
+  rev = NULL;
+
+  calculate_retained();
+  calculate_children();
 
   progress->complete();
 }
 
-void DominatorTree::retained_size(RubyHeapObj *obj, size_t &size) {
-  size += obj->is_root_object() ? 0 : obj->get_memsize();
+// Every node comes after its idom in DFS preorder, so walking it backwards
+// rolls each subtree up into its idom before the idom itself is visited.
+void DominatorTree::calculate_retained() {
+  retained_size_buf.assign(num_nodes, 0);
+  retained_count_buf.assign(num_nodes, 0);
+  for (int32_t i = 1; i < num_nodes; ++i) {
+    if ((store->get_flags(i) & RUBY_T_MASK) != RUBY_T_ROOT) {
+      retained_size_buf[i] = store->get_memsize(i);
+      retained_count_buf[i] = 1;
+    }
+  }
 
-  if (obj != root) {
-    auto t = tree[obj->get_index()];
-    if (t->size() == 1) {
-      return;
-    } else {
-      for (size_t i = 1; i < t->size(); i++) {
-        RubyHeapObj *obj = objs[(*t)[i]];
-        retained_size(obj, size);
-      }
+  for (int32_t i = count; i >= 2; --i) {
+    uint32_t v = order[i];
+    retained_size_buf[idoms[v]] += retained_size_buf[v];
+    retained_count_buf[idoms[v]] += retained_count_buf[v];
+  }
+
+  retained_sizes = retained_size_buf.data();
+  retained_counts = retained_count_buf.data();
+}
+
+// Counts each node's children, turns the counts into offsets and fills the
+// rows in DFS preorder, then sorts each row by retained size. The sort is
+// stable, so ties stay in preorder.
+void DominatorTree::calculate_children() {
+  child_offset_buf.assign(num_nodes + 1, 0);
+  for (int32_t i = 2; i <= count; ++i) {
+    child_offset_buf[idoms[order[i]] + 1]++;
+  }
+  for (int32_t i = 1; i <= num_nodes; ++i) {
+    child_offset_buf[i] += child_offset_buf[i - 1];
+  }
+
+  std::vector<uint32_t> next(child_offset_buf.begin(), child_offset_buf.end() - 1);
+  child_buf.resize(count > 1 ? count - 1 : 0);
+  for (int32_t i = 2; i <= count; ++i) {
+    child_buf[next[idoms[order[i]]]++] = order[i];
+  }
+
+  for (int32_t i = 0; i < num_nodes; ++i) {
+    if (child_offset_buf[i + 1] - child_offset_buf[i] < 2) {
+      continue;
     }
+    std::stable_sort(child_buf.begin() + child_offset_buf[i], child_buf.begin() + child_offset_buf[i + 1],
+        [&] (uint32_t a, uint32_t b) {
+      return retained_sizes[a] > retained_sizes[b];
+    });
   }
+
+  child_offsets = child_offset_buf.data();
+  children = child_buf.data();
 }
 
 }
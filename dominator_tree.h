@@ -11,51 +11,145 @@
 
 namespace harb {
 
+// Dominator tree of everything reachable from the root. There are three ways
+// to calculate it, which give the same tree:
+//
+//   lt        Lengauer-Tarjan with per-node buckets of semidominator
+//             children
+//   snca      Semi-NCA: the same semidominators, then each idom found by
+//             walking up the partial tree from the node's parent; no
+//             buckets, and usually faster on heaps, where the tree is
+//             shallow
+//   parallel  iterative data-flow over the DFS preorder, split across
+//             threads; slower than snca on one thread, but scales
 class DominatorTree {
   public:
-    DominatorTree(RubyHeapObj *root, int32_t num_nodes);
+    enum Algorithm {
+      kLengauerTarjan = 0,
+      kSemiNCA,
+      kParallel,
+      kNumAlgorithms
+    };
+
+    static const Algorithm kDefaultAlgorithm = kSemiNCA;
+
+    // Returns false if name isn't one of the names above.
+    static bool parse_algorithm(const char *name, Algorithm &algorithm);
+    static const char * algorithm_name(Algorithm algorithm);
+
+    DominatorTree(RubyHeapObj root, int32_t num_nodes, Algorithm algorithm = kDefaultAlgorithm);
     ~DominatorTree();
 
+    // Wraps the arrays of a tree calculated earlier (see the accessors
+    // below), which are used in place and must outlive the tree.
+    static DominatorTree * load(RubyHeapObj root, int32_t num_nodes, int32_t count,
+        const uint32_t *order, const uint32_t *idoms,
+        const uint32_t *child_offsets, const uint32_t *children,
+        const uint64_t *retained_sizes, const uint32_t *retained_counts);
+
+    // Threads used by the parallel algorithm; the DFS that numbers nodes
+    // always runs on one.
+    void set_num_threads(unsigned num_threads) { this->num_threads = num_threads ? num_threads : 1; }
+
     void calculate();
 
-    void retained_size(RubyHeapObj *obj, size_t &size);
+    // Number of nodes reachable from the root, and the i'th of them
+    // (1 <= i <= count) in DFS preorder. Every node comes after its idom.
+    int32_t get_num_reachable() { return count; }
+
+    RubyHeapObj get_dfs_node(int32_t i) { return RubyHeapObj(store, order[i]); }
+
+    // Memsize of the object plus everything it dominates, and the number of
+    // objects that is. Unreachable objects only retain themselves.
+    uint64_t get_retained_size(RubyHeapObj obj) { return retained_sizes[obj.get_index()]; }
+    uint32_t get_retained_count(RubyHeapObj obj) { return retained_counts[obj.get_index()]; }
 
-    RubyHeapObj * get_idom(RubyHeapObj *obj) {
-      auto t = tree[obj->get_index()];
-      return objs[(*t)[0]];
+    // Returns a null handle for the root and nodes that aren't reachable
+    // from it.
+    RubyHeapObj get_idom(RubyHeapObj obj) {
+      uint32_t idom = idoms[obj.get_index()];
+      return idom ? RubyHeapObj(store, idom) : RubyHeapObj();
     }
 
-    void get_dominators(RubyHeapObj *obj, std::vector<RubyHeapObj *> &dominators) {
-      auto t = tree[obj->get_index()];
-      for (size_t i = 1; i < t->size(); ++i) {
-        dominators.push_back(objs[(*t)[i]]);
+    // Nodes obj is the immediate dominator of, largest retained size first
+    // (ties in DFS preorder).
+    size_t get_num_children(RubyHeapObj obj) {
+      return child_offsets[obj.get_index() + 1] - child_offsets[obj.get_index()];
+    }
+    const uint32_t * get_children(RubyHeapObj obj) { return children + child_offsets[obj.get_index()]; }
+
+    void get_dominators(RubyHeapObj obj, std::vector<RubyHeapObj> &dominators) {
+      const uint32_t *c = get_children(obj);
+      for (size_t i = 0, n = get_num_children(obj); i < n; ++i) {
+        dominators.push_back(RubyHeapObj(store, c[i]));
       }
     }
 
+    // The arrays behind the accessors above. order has count + 1 entries;
+    // idoms and the retained arrays are indexed by node index and have
+    // num_nodes + 1; child_offsets has num_nodes + 2, and children, listed
+    // row by row, count - 1.
+    const uint32_t * get_order() { return order; }
+    const uint32_t * get_idoms() { return idoms; }
+    const uint32_t * get_child_offsets() { return child_offsets; }
+    const uint32_t * get_children() { return children; }
+    const uint64_t * get_retained_sizes() { return retained_sizes; }
+    const uint32_t * get_retained_counts() { return retained_counts; }
+
   private:
-    RubyHeapObj *root;
+    RubyHeapObj root;
+    ObjectStore *store;
     int32_t num_nodes;
     int32_t count;
+    Algorithm algorithm;
+    unsigned num_threads;
     int32_t *arr;
+    // Aliases order_buf while calculating.
     int32_t *rev;
     int32_t *label;
     int32_t *sdom;
     int32_t *dom;
     int32_t *parent;
     int32_t *dsu;
-    RubyHeapObj **objs;
-    std::vector<int32_t> **reverse_graph;
+    // Scratch space for the DFS and for find's path compression.
+    int32_t *stack;
     std::vector<int32_t> **bucket;
-    std::vector<int32_t> **tree;
+
+    // The finished tree: the idom of every node plus its children in
+    // compressed sparse row form.
+    const uint32_t *order;
+    const uint32_t *idoms;
+    const uint32_t *child_offsets;
+    const uint32_t *children;
+    const uint64_t *retained_sizes;
+    const uint32_t *retained_counts;
+
+    // Backing storage for the arrays above when the tree was calculated
+    // rather than loaded.
+    std::vector<uint32_t> order_buf;
+    std::vector<uint32_t> idom_buf;
+    std::vector<uint32_t> child_offset_buf;
+    std::vector<uint32_t> child_buf;
+    std::vector<uint64_t> retained_size_buf;
+    std::vector<uint32_t> retained_count_buf;
 
     harb::Progress *progress;
 
-    void dfs(RubyHeapObj *node);
-    void dfs_child(RubyHeapObj *obj, RubyHeapObj *child);
+    DominatorTree(RubyHeapObj root, int32_t num_nodes, int32_t count,
+        const uint32_t *order, const uint32_t *idoms,
+        const uint32_t *child_offsets, const uint32_t *children,
+        const uint64_t *retained_sizes, const uint32_t *retained_counts);
+
+    void dfs(uint32_t root);
+    void visit(uint32_t v);
     void calculate_sdom();
+    void calculate_snca();
+    void calculate_parallel();
+    void calculate_retained();
+    void calculate_children();
     void cleanup_intermediate_state();
 
-    int32_t find(int32_t u, int32_t x = 0);
+    int32_t find(int32_t u);
     void _union(int32_t u, int32_t v);
 };
 
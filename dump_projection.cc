@@ -0,0 +1,193 @@
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <numeric>
+
+#include "dump_projection.h"
+#include "parallel.h"
+#include "scan.h"
+
+namespace harb {
+
+// Returns a pointer to the value of key (given with its quotes) in the line
+// [p, end), or NULL if the line doesn't have it. Quotes inside strings are
+// escaped, so a match can't start inside a value.
+static const char *
+find_value(const char *p, const char *end, const char *key, size_t key_length) {
+  p = (const char *) memmem(p, end - p, key, key_length);
+  if (!p) {
+    return NULL;
+  }
+  for (p += key_length; p < end && (*p == ' ' || *p == ':'); ++p) {
+  }
+  return p;
+}
+
+// Copies the string value at p (its opening quote) into out, escapes and
+// all. Returns false if it isn't a string.
+static bool
+read_string(const char *p, const char *end, std::string &out) {
+  if (p >= end || *p != '"') {
+    return false;
+  }
+  const char *q = ++p;
+  while ((q = scan::find_quote_or_backslash(q, end)) < end && *q == '\\') {
+    q += 2;
+  }
+  if (q >= end) {
+    return false;
+  }
+  out.assign(p, q - p);
+  return true;
+}
+
+#define FIND_VALUE(p, end, key) find_value(p, end, key, sizeof(key) - 1)
+
+void DumpProjection::scan_lines(const char *p, const char *end, bool details, unsigned thread,
+    const std::function<void(unsigned, const Object &)> &func) {
+  Object obj = { 0, 0, 0, RUBY_T_NONE, std::string() };
+  std::string str;
+  while (p < end) {
+    const char *eol = scan::find_newline(p, end);
+    const char *value = FIND_VALUE(p, eol, "\"address\"");
+    if (!value || !scan::parse_hex_string(value, eol, obj.addr)) {
+      p = eol + 1;
+      continue;
+    }
+
+    if (details) {
+      obj.type = RUBY_T_NONE;
+      if ((value = FIND_VALUE(p, eol, "\"type\"")) && read_string(value, eol, str)) {
+        obj.type = RubyHeapObj::get_value_type(str.c_str());
+      }
+
+      obj.klass = 0;
+      if ((value = FIND_VALUE(p, eol, "\"class\""))) {
+        scan::parse_hex_string(value, eol, obj.klass);
+      }
+
+      obj.memsize = (value = FIND_VALUE(p, eol, "\"memsize\"")) ? strtoull(value, NULL, 10) : 0;
+
+      obj.name.clear();
+      if ((obj.type == RUBY_T_CLASS || obj.type == RUBY_T_MODULE) &&
+          (value = FIND_VALUE(p, eol, "\"name\""))) {
+        read_string(value, eol, obj.name);
+      }
+    }
+
+    func(thread, obj);
+    p = eol + 1;
+  }
+}
+
+#undef FIND_VALUE
+
+template<typename T> static void
+permute(const std::vector<uint32_t> &perm, std::vector<T> &column) {
+  std::vector<T> sorted(perm.size());
+  for (size_t i = 0; i < perm.size(); ++i) {
+    sorted[i] = column[perm[i]];
+  }
+  column.swap(sorted);
+}
+
+const char * DumpProjection::get_class_name(uint64_t addr) const {
+  auto it = std::lower_bound(names_.begin(), names_.end(), std::make_pair(addr, std::string()));
+  return it != names_.end() && it->first == addr ? it->second.c_str() : NULL;
+}
+
+void DumpProjection::stream(FILE *f, unsigned num_threads, bool details,
+    const std::function<void(unsigned, const Object &)> &func) {
+  struct stat st;
+  void *mapped = MAP_FAILED;
+  if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  }
+
+  if (mapped == MAP_FAILED) {
+    std::vector<char> data;
+    char buf[16384];
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0;) {
+      data.insert(data.end(), buf, buf + n);
+    }
+    scan_lines(data.data(), data.data() + data.size(), details, 0, func);
+    return;
+  }
+
+  const char *begin = (const char *) mapped;
+  const char *end = begin + st.st_size;
+  madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+
+  // Each thread starts at the first line that begins in its range.
+  parallel_ranges(st.st_size, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    const char *p = begin + lo;
+    if (lo > 0 && p[-1] != '\n') {
+      p = std::min(scan::find_newline(p, end) + 1, end);
+    }
+    const char *stop = begin + hi;
+    if (stop < end && stop[-1] != '\n') {
+      stop = std::min(scan::find_newline(stop, end) + 1, end);
+    }
+    if (p < stop) {
+      scan_lines(p, stop, details, t, func);
+    }
+  });
+  munmap(mapped, st.st_size);
+}
+
+DumpProjection::DumpProjection(FILE *f, unsigned num_threads, bool details) {
+  std::vector<Part> parts(std::max(num_threads, 1u));
+  stream(f, num_threads, details, [&] (unsigned t, const Object &obj) {
+    Part &part = parts[t];
+    part.addrs.push_back(obj.addr);
+    if (details) {
+      part.types.push_back(obj.type);
+      part.classes.push_back(obj.klass);
+      part.memsizes.push_back(obj.memsize);
+      if (!obj.name.empty()) {
+        part.names.push_back(std::make_pair(obj.addr, obj.name));
+      }
+    }
+  });
+
+  for (auto &part : parts) {
+    addrs_.insert(addrs_.end(), part.addrs.begin(), part.addrs.end());
+    types_.insert(types_.end(), part.types.begin(), part.types.end());
+    classes_.insert(classes_.end(), part.classes.begin(), part.classes.end());
+    memsizes_.insert(memsizes_.end(), part.memsizes.begin(), part.memsizes.end());
+    names_.insert(names_.end(), part.names.begin(), part.names.end());
+    part = Part();
+  }
+
+  if (!details) {
+    std::sort(addrs_.begin(), addrs_.end());
+    addrs_.erase(std::unique(addrs_.begin(), addrs_.end()), addrs_.end());
+    return;
+  }
+
+  // Sorts the columns together, keeping the last of any repeated address
+  // the way the address index does.
+  std::vector<uint32_t> perm(addrs_.size());
+  std::iota(perm.begin(), perm.end(), 0);
+  std::stable_sort(perm.begin(), perm.end(), [&] (uint32_t a, uint32_t b) {
+    return addrs_[a] < addrs_[b];
+  });
+  size_t n = 0;
+  for (size_t i = 0; i < perm.size(); ++i) {
+    if (i + 1 < perm.size() && addrs_[perm[i + 1]] == addrs_[perm[i]]) {
+      continue;
+    }
+    perm[n++] = perm[i];
+  }
+  perm.resize(n);
+
+  permute(perm, addrs_);
+  permute(perm, types_);
+  permute(perm, classes_);
+  permute(perm, memsizes_);
+
+  std::sort(names_.begin(), names_.end());
+}
+
+}
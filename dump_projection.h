@@ -0,0 +1,87 @@
+#ifndef HARB_DUMP_PROJECTION_H
+#define HARB_DUMP_PROJECTION_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+// The objects in a dump, read without building a graph: each line is only
+// searched for the handful of keys kept, and the objects are stored as
+// columns sorted by address. Only the addresses are read unless details
+// are asked for, in which case each object's type, class and memsize are
+// too, along with the names of the dump's classes. A mapped dump is split
+// at line boundaries and scanned on several threads.
+class DumpProjection {
+public:
+  // One object as the projection reads it. Without details only addr is
+  // set; name is only set for named classes and modules.
+  struct Object {
+    uint64_t addr;
+    uint64_t klass;
+    uint64_t memsize;
+    RubyValueType type;
+    std::string name;
+  };
+
+  DumpProjection(FILE *f, unsigned num_threads, bool details = false);
+
+  // Reads f the same way without keeping anything, calling func(thread,
+  // object) for each object on the thread that read it, in file order
+  // within each thread.
+  static void stream(FILE *f, unsigned num_threads, bool details,
+      const std::function<void(unsigned, const Object &)> &func);
+
+  // Number of distinct addresses.
+  size_t size() const { return addrs_.size(); }
+
+  const std::vector<uint64_t> & get_addrs() const { return addrs_; }
+
+  bool contains(uint64_t addr) const {
+    return std::binary_search(addrs_.begin(), addrs_.end(), addr);
+  }
+
+  // Details of the i'th object by address; the class is 0 when it has none.
+  RubyValueType get_type(size_t i) const { return (RubyValueType) types_[i]; }
+  uint64_t get_class(size_t i) const { return classes_[i]; }
+  uint64_t get_memsize(size_t i) const { return memsizes_[i]; }
+
+  // The name of the class or module at addr, or NULL if it's anonymous or
+  // not in the dump.
+  const char * get_class_name(uint64_t addr) const;
+
+private:
+  // Columns for one thread's part of the dump, in file order.
+  struct Part {
+    std::vector<uint64_t> addrs;
+    std::vector<uint8_t> types;
+    std::vector<uint64_t> classes;
+    std::vector<uint64_t> memsizes;
+    std::vector<std::pair<uint64_t, std::string>> names;
+  };
+
+  std::vector<uint64_t> addrs_;
+  std::vector<uint8_t> types_;
+  std::vector<uint64_t> classes_;
+  std::vector<uint64_t> memsizes_;
+
+  // Sorted by address.
+  std::vector<std::pair<uint64_t, std::string>> names_;
+
+  // Calls func(thread, object) for every object in [p, end).
+  static void scan_lines(const char *p, const char *end, bool details, unsigned thread,
+      const std::function<void(unsigned, const Object &)> &func);
+};
+
+}
+
+#endif // HARB_DUMP_PROJECTION_H
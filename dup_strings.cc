@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+#include "sparsehash/dense_hash_map"
+
+#include "class_stats.h"
+#include "dup_strings.h"
+#include "graph.h"
+#include "parallel.h"
+#include "retainer_tree.h"
+
+namespace harb {
+
+namespace {
+
+// A string's interned value and its length.
+typedef std::pair<uint64_t, uint32_t> string_key_t;
+
+struct StringKeyHash {
+  size_t operator()(const string_key_t &key) const {
+    return mix(key.first ^ ((uint64_t) key.second << 40));
+  }
+
+  // splitmix64's finalizer; offsets are too regular to use as they are.
+  static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+};
+
+typedef google::dense_hash_map<string_key_t, DupStrings::Entry, StringKeyHash> group_map_t;
+
+string_key_t key_for(ObjectStore *store, uint32_t i) {
+  return string_key_t(store->get_value_offset(i), store->get_size(i));
+}
+
+// Partitions per thread, so each string's partition holds all its copies
+// and the partitions can be grouped independently.
+const unsigned kPartitionsPerThread = 8;
+
+// Calls func(partition) for each partition, threads taking the next one as
+// they finish.
+template<typename Func> void
+each_partition(unsigned num_partitions, unsigned num_threads, Func func) {
+  std::atomic<unsigned> next(0);
+  parallel_ranges(num_threads, num_threads, [&] (unsigned, size_t, size_t) {
+    for (unsigned p; (p = next++) < num_partitions;) {
+      func(p);
+    }
+  });
+}
+
+}
+
+// Three passes. The first splits the strings into partitions by the hash of
+// their content, a list per thread and partition so nothing is shared. The
+// second groups each partition's strings in its own table, so no tables
+// need merging, and keeps the groups with more than one copy. The last goes
+// over the partitions again to count the retainers of the top groups.
+DupStrings::DupStrings(Graph *graph, unsigned num_threads, size_t max_entries)
+  : num_strings_(0), num_duplicates_(0), wasted_(0) {
+  num_threads = std::max(num_threads, 1u);
+  ObjectStore *store = graph->get_store();
+  uint32_t n = store->get_num_objects();
+  unsigned num_partitions = num_threads * kPartitionsPerThread;
+  StringKeyHash hash;
+
+  std::vector<std::vector<std::vector<uint32_t>>> partitions(num_threads,
+      std::vector<std::vector<uint32_t>>(num_partitions));
+  std::vector<uint64_t> num_strings(num_threads, 0);
+  parallel_ranges(n, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    for (uint32_t i = lo + 1; i <= hi; ++i) {
+      if (store->is_removed(i) || (store->get_flags(i) & RUBY_T_MASK) != RUBY_T_STRING ||
+          !store->get_value_offset(i)) {
+        continue;
+      }
+      partitions[t][hash(key_for(store, i)) % num_partitions].push_back(i);
+      num_strings[t]++;
+    }
+  });
+
+  std::vector<std::vector<Entry>> groups(num_partitions);
+  each_partition(num_partitions, num_threads, [&] (unsigned p) {
+    group_map_t table;
+    table.set_empty_key(string_key_t(0, 0));
+    for (auto &part : partitions) {
+      for (uint32_t i : part[p]) {
+        string_key_t key = key_for(store, i);
+        auto it = table.find(key);
+        if (it == table.end()) {
+          Entry entry = { key.first, key.second, 0, 0, 0, store->get_memsize(i), i, std::vector<Retainer>() };
+          it = table.insert(std::make_pair(key, entry)).first;
+        }
+        Entry &entry = it->second;
+        entry.count++;
+        entry.frozen += (store->get_flags(i) & RUBY_FL_FROZEN) != 0;
+        entry.memsize += store->get_memsize(i);
+        // The smallest copy until the end.
+        entry.wasted = std::min(entry.wasted, (uint64_t) store->get_memsize(i));
+      }
+    }
+    for (auto &it : table) {
+      if (it.second.count > 1) {
+        it.second.wasted = it.second.memsize - it.second.wasted;
+        groups[p].push_back(it.second);
+      }
+    }
+  });
+
+  for (auto count : num_strings) {
+    num_strings_ += count;
+  }
+  for (auto &group : groups) {
+    for (auto &entry : group) {
+      num_duplicates_ += entry.count - 1;
+      wasted_ += entry.wasted;
+    }
+    entries_.insert(entries_.end(), group.begin(), group.end());
+    std::vector<Entry>().swap(group);
+  }
+  std::sort(entries_.begin(), entries_.end(), [] (const Entry &a, const Entry &b) {
+    return a.wasted > b.wasted || (a.wasted == b.wasted && a.sample < b.sample);
+  });
+
+  max_entries = std::min(max_entries, entries_.size());
+  google::dense_hash_map<string_key_t, size_t, StringKeyHash> positions;
+  positions.set_empty_key(string_key_t(0, 0));
+  for (size_t e = 0; e < max_entries; ++e) {
+    positions[string_key_t(entries_[e].value, entries_[e].size)] = e;
+  }
+
+  // Retainer counts per partition and top entry.
+  std::vector<std::vector<google::dense_hash_map<uint64_t, uint64_t>>> counts(num_partitions);
+  each_partition(num_partitions, num_threads, [&] (unsigned p) {
+    for (auto &part : partitions) {
+      for (uint32_t i : part[p]) {
+        auto it = positions.find(key_for(store, i));
+        if (it == positions.end()) {
+          continue;
+        }
+        RubyHeapObj idom = graph->get_idom(RubyHeapObj(store, i));
+        if (!idom) {
+          continue;
+        }
+        if (counts[p].empty()) {
+          counts[p].resize(max_entries);
+          for (auto &table : counts[p]) {
+            table.set_empty_key(0);
+          }
+        }
+        uint64_t key = idom.is_root_object() ? RetainerTree::kRootKey | idom.get_index() : ClassStats::key_for(idom);
+        counts[p][it->second][key]++;
+      }
+    }
+  });
+
+  for (size_t e = 0; e < max_entries; ++e) {
+    google::dense_hash_map<uint64_t, uint64_t> totals;
+    totals.set_empty_key(0);
+    for (auto &tables : counts) {
+      if (!tables.empty()) {
+        for (auto &it : tables[e]) {
+          totals[it.first] += it.second;
+        }
+      }
+    }
+
+    std::vector<Retainer> &retainers = entries_[e].retainers;
+    for (auto &it : totals) {
+      Retainer retainer = { it.first, it.second };
+      retainers.push_back(retainer);
+    }
+    std::sort(retainers.begin(), retainers.end(), [] (const Retainer &a, const Retainer &b) {
+      return a.count > b.count || (a.count == b.count && a.key < b.key);
+    });
+    if (retainers.size() > kMaxRetainers) {
+      retainers.resize(kMaxRetainers);
+    }
+  }
+}
+
+}
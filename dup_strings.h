@@ -0,0 +1,63 @@
+#ifndef HARB_DUP_STRINGS_H
+#define HARB_DUP_STRINGS_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+class Graph;
+
+// Strings with the same content, grouped by their interned value and
+// length. Every copy but the smallest is counted as wasted, since one
+// (frozen) copy could be shared instead. Strings dumped without a value
+// (binary or broken encodings) are left out.
+class DupStrings {
+public:
+  static const size_t kMaxRetainers = 3;
+
+  struct Retainer {
+    // A RetainerTree key: the class of the copies' immediate dominator.
+    uint64_t key;
+    uint64_t count;
+  };
+
+  struct Entry {
+    uint64_t value;
+    uint32_t size;
+    uint64_t count;
+    uint64_t frozen;
+    uint64_t memsize;
+    uint64_t wasted;
+    // One of the copies.
+    uint32_t sample;
+    // Most copies first, at most kMaxRetainers.
+    std::vector<Retainer> retainers;
+  };
+
+  // Finds every duplicated string, splitting the work over num_threads, and
+  // the retainers of the max_entries that waste the most.
+  DupStrings(Graph *graph, unsigned num_threads, size_t max_entries);
+
+  // Most wasted bytes first; only the first max_entries have retainers.
+  const std::vector<Entry> & entries() const { return entries_; }
+
+  uint64_t get_num_strings() const { return num_strings_; }
+  // Copies beyond the first of each group.
+  uint64_t get_num_duplicates() const { return num_duplicates_; }
+  uint64_t get_wasted() const { return wasted_; }
+
+private:
+  std::vector<Entry> entries_;
+  uint64_t num_strings_;
+  uint64_t num_duplicates_;
+  uint64_t wasted_;
+};
+
+}
+
+#endif // HARB_DUP_STRINGS_H
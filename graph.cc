@@ -1,97 +1,147 @@
 #include <stdio.h>
 
+#include <algorithm>
+
 #include "progress.h"
 #include "graph.h"
 #include "parser.h"
 
 namespace harb {
 
-Graph::Graph(FILE *f) {
+Graph::Graph(FILE *f, const GraphOptions &options)
+  : snapshot_(NULL), address_index_(options.address_index), num_threads_(options.num_threads),
+    dominator_algorithm_(options.dominator_algorithm), num_retained_sorted_(0),
+    class_stats_(NULL), root_path_finder_(NULL) {
   fseeko(f, 0, SEEK_END);
   Progress progress("parsing", ftello(f));
   fseeko(f, 0, SEEK_SET);
   progress.start();
 
-  parser_ = new Parser(f);
+  store_.set_graph(this);
+  parser_ = new Parser(f, &store_);
+  parser_->set_num_threads(options.num_threads);
 
   root_ = parser_->create_heap_object(RUBY_T_ROOT);
+  store_.set_root(root_.get_index());
 
-  parser_->parse([&] (RubyHeapObj *obj) {
-    obj->graph = this;
-    if (obj->is_root_object()) {
-      root_->as.root.children->push_back(obj);
-    } else {
-      heap_map_[obj->as.obj.addr] = obj;
+  parser_->parse([&] (RubyHeapObj obj) {
+    if (obj.is_root_object()) {
+      store_.add_root_child(obj.get_index());
     }
-    progress.update(ftello(f));
+    progress.update(parser_->get_position());
   });
 
   progress.complete();
 
+  num_objects_ = store_.get_num_objects();
+
+  build_address_index();
+
   update_references();
 
   build_dominator_tree();
 }
 
-void Graph::add_inverse_obj_references(RubyHeapObj *obj) {
-  if (obj->refs_to.obj == NULL) {
-    return;
-  }
+// The object store's columns and the dominator tree point straight into the
+// snapshot; only the address index is rebuilt.
+Graph::Graph(Snapshot *snapshot, const GraphOptions &options)
+  : parser_(NULL), snapshot_(snapshot), address_index_(options.address_index),
+    num_threads_(options.num_threads), dominator_algorithm_(options.dominator_algorithm),
+    num_retained_sorted_(0), class_stats_(NULL), root_path_finder_(NULL) {
+  const Snapshot::Header *header = snapshot->header();
+  num_objects_ = header->num_objects;
 
-  for (int i = 0; obj->refs_to.obj[i] != NULL; ++i) {
-    obj->refs_to.obj[i]->refs_from.push_back(obj);
-  }
-}
+  Progress progress("loading snapshot", 2);
+  progress.start();
 
-void Graph::update_obj_references(RubyHeapObj *obj) {
-  if (obj->refs_to.addr) {
-    size_t count = 0;
-    for (size_t i = 0; obj->refs_to.addr[i]; ++i) {
-      RubyHeapObj *ref = get_heap_object(obj->refs_to.addr[i]);
-      if (ref) {
-        obj->refs_to.obj[count++] = ref;
-      } else {
-        // TODO: warn here?
-      }
-    }
-    for (size_t i = count; obj->refs_to.addr[i]; ++i) {
-      obj->refs_to.addr[i] = 0;
-    }
-  }
+  store_.set_graph(this);
+  store_.view(num_objects_,
+      snapshot->section<uint64_t>(Snapshot::kAddr),
+      snapshot->section<uint32_t>(Snapshot::kFlags),
+      snapshot->section<uint32_t>(Snapshot::kClass),
+      snapshot->section<uint64_t>(Snapshot::kMemsize),
+      snapshot->section<uint64_t>(Snapshot::kValue),
+      snapshot->section<uint32_t>(Snapshot::kSize),
+      snapshot->section<uint64_t>(Snapshot::kFile),
+      snapshot->section<uint32_t>(Snapshot::kLine),
+      snapshot->section<uint64_t>(Snapshot::kMethod),
+      snapshot->section<uint32_t>(Snapshot::kGeneration),
+      snapshot->section<uint64_t>(Snapshot::kRefsToOffsets),
+      snapshot->section<uint32_t>(Snapshot::kRefsTo),
+      snapshot->section<uint64_t>(Snapshot::kRefsFromOffsets),
+      snapshot->section<uint32_t>(Snapshot::kRefsFrom),
+      snapshot->section<char>(Snapshot::kStrings),
+      header->sizes[Snapshot::kStrings]);
+  store_.set_root(1);
+  root_ = RubyHeapObj(&store_, 1);
+
+  address_index_.build(store_, [] (uint32_t) {});
+  progress.increment();
+
+  dominator_tree_ = DominatorTree::load(root_, num_objects_, header->num_reachable,
+      snapshot->section<uint32_t>(Snapshot::kDfsOrder),
+      snapshot->section<uint32_t>(Snapshot::kIdom),
+      snapshot->section<uint32_t>(Snapshot::kDomChildOffsets),
+      snapshot->section<uint32_t>(Snapshot::kDomChildren),
+      snapshot->section<uint64_t>(Snapshot::kRetainedSize),
+      snapshot->section<uint32_t>(Snapshot::kRetainedCount));
+
+  progress.complete();
+}
 
-  obj->as.obj.clazz.obj = get_heap_object(obj->as.obj.clazz.addr);
+// A later object with the same address replaces an earlier one.
+void Graph::build_address_index() {
+  address_index_.build(store_, [&] (uint32_t i) {
+    store_.remove(i);
+  });
 }
 
 void Graph::update_references() {
-  size_t num_heap_objects = heap_map_.size();
-  RubyHeapObjList *roots = root_->as.root.children;
-  harb::Progress progress("updating references", num_heap_objects + roots->size());
+  harb::Progress progress("updating references", 2);
   progress.start();
-  for (auto it = heap_map_.begin(); it != heap_map_.end(); ++it) {
-    update_obj_references(it->second);
-    add_inverse_obj_references(it->second);
-    progress.increment();
-  }
-  for (auto it = roots->begin(); it != roots->end(); ++it) {
-    update_obj_references(*it);
-    add_inverse_obj_references(*it);
-    progress.increment();
-  }
+  store_.resolve(address_index_, num_threads_);
+  progress.increment();
+  store_.add_inverse_references(num_threads_);
   progress.complete();
 }
 
 void Graph::build_dominator_tree() {
-  dominator_tree_ = new DominatorTree(root_, parser_->get_heap_object_count());
+  dominator_tree_ = new DominatorTree(root_, num_objects_, dominator_algorithm_);
+  dominator_tree_->set_num_threads(num_threads_);
   dominator_tree_->calculate();
 }
 
-RubyHeapObj* Graph::get_heap_object(uint64_t addr) {
-  auto it = heap_map_.find(addr);
-  if (it == heap_map_.end()) {
-    return NULL;
+void Graph::build_retained_order() {
+  if (!retained_order_.empty()) {
+    return;
   }
-  return it->second;
+  retained_order_.reserve(address_index_.size());
+  each_heap_object([&] (RubyHeapObj obj) {
+    retained_order_.push_back(obj.get_index());
+  });
 }
 
+// Sorts at least the first n entries of retained_order_, at least doubling
+// the sorted prefix each time, so a query for the top N costs a partial
+// sort of the unsorted remainder the first time and nothing after that.
+void Graph::sort_retained_order(size_t n) {
+  static const size_t kMinChunk = 1024;
+  n = std::min(std::max(n, std::max(num_retained_sorted_ * 2, kMinChunk)), retained_order_.size());
+  if (n <= num_retained_sorted_) {
+    return;
+  }
+
+  const uint64_t *sizes = dominator_tree_->get_retained_sizes();
+  std::partial_sort(retained_order_.begin() + num_retained_sorted_, retained_order_.begin() + n,
+      retained_order_.end(), [&] (uint32_t a, uint32_t b) {
+    return sizes[a] > sizes[b] || (sizes[a] == sizes[b] && a < b);
+  });
+  num_retained_sorted_ = n;
 }
 
+RubyHeapObj Graph::get_heap_object(uint64_t addr) {
+  uint32_t i = address_index_.find(addr);
+  return i ? RubyHeapObj(&store_, i) : RubyHeapObj();
+}
+
+}
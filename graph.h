@@ -3,50 +3,137 @@
 
 #include <inttypes.h>
 
-#include "sparsehash/sparse_hash_map"
+#include <vector>
 
+#include "address_index.h"
+#include "class_stats.h"
+#include "object_store.h"
 #include "parser.h"
+#include "retainer_tree.h"
 #include "ruby_heap_obj.h"
 #include "dominator_tree.h"
+#include "root_path.h"
+#include "snapshot.h"
 
 namespace harb {
 
+struct GraphOptions {
+  // Threads used to parse mapped dumps, resolve references and, with the
+  // parallel algorithm, calculate the dominator tree.
+  unsigned num_threads;
+
+  AddressIndex::Kind address_index;
+
+  DominatorTree::Algorithm dominator_algorithm;
+
+  GraphOptions()
+    : num_threads(1), address_index(AddressIndex::kDefault),
+      dominator_algorithm(DominatorTree::kDefaultAlgorithm) {}
+};
+
 class Graph {
-  typedef google::sparse_hash_map<uint64_t, RubyHeapObj *> RubyHeapObjMap;
+  friend class Snapshot;
+  friend class ClassStats;
+  friend class RetainerTree;
 
+  ObjectStore store_;
   Parser *parser_;
-  RubyHeapObj *root_;
-  RubyHeapObjMap heap_map_;
+  Snapshot *snapshot_;
+  RubyHeapObj root_;
+  AddressIndex address_index_;
   DominatorTree *dominator_tree_;
+  int32_t num_objects_;
+  unsigned num_threads_;
+  DominatorTree::Algorithm dominator_algorithm_;
 
-  void add_inverse_obj_references(RubyHeapObj *obj);
-  void update_obj_references(RubyHeapObj *obj);
+  // Objects other than roots ordered by retained size, largest first. It's
+  // built on first use and only the first num_retained_sorted_ are sorted;
+  // the rest are sorted in growing chunks as queries reach them.
+  std::vector<uint32_t> retained_order_;
+  size_t num_retained_sorted_;
+
+  // Built on first use.
+  ClassStats *class_stats_;
+  RootPathFinder *root_path_finder_;
+
+  void build_address_index();
   void update_references();
   void build_dominator_tree();
+  void build_retained_order();
+  void sort_retained_order(size_t n);
 
 public:
-  Graph(FILE *f);
+  Graph(FILE *f, const GraphOptions &options = GraphOptions());
+  Graph(Snapshot *snapshot, const GraphOptions &options = GraphOptions());
+
+  RubyHeapObj get_heap_object(uint64_t addr);
 
-  RubyHeapObj* get_heap_object(uint64_t addr);
+  ObjectStore * get_store() { return &store_; }
 
-  RubyHeapObj* get_idom(RubyHeapObj *obj) {
+  RubyHeapObj get_idom(RubyHeapObj obj) {
     return dominator_tree_->get_idom(obj);
   }
 
-  void get_dominators(RubyHeapObj *obj, std::vector<RubyHeapObj *> &dominators) {
+  void get_dominators(RubyHeapObj obj, std::vector<RubyHeapObj> &dominators) {
     return dominator_tree_->get_dominators(obj, dominators);
   }
 
-  size_t get_retained_size(RubyHeapObj *obj) {
-    size_t size = 0;
-    dominator_tree_->retained_size(obj, size);
-    return size;
+  size_t get_retained_size(RubyHeapObj obj) {
+    return dominator_tree_->get_retained_size(obj);
+  }
+
+  size_t get_retained_count(RubyHeapObj obj) {
+    return dominator_tree_->get_retained_count(obj);
   }
 
-  size_t get_num_heap_objects() { return heap_map_.size(); }
+  size_t get_num_heap_objects() { return address_index_.size(); }
+
+  unsigned get_num_threads() const { return num_threads_; }
+
+  // See RootPathFinder::find.
+  bool find_root_path(RubyHeapObj obj, std::vector<RubyHeapObj> &path) {
+    if (!root_path_finder_) {
+      root_path_finder_ = new RootPathFinder(&store_, root_);
+    }
+    return root_path_finder_->find(obj, path);
+  }
+
+  // See RootPathFinder::find_k.
+  void find_root_paths(RubyHeapObj obj, size_t k, std::vector<std::vector<RubyHeapObj>> &paths) {
+    if (!root_path_finder_) {
+      root_path_finder_ = new RootPathFinder(&store_, root_);
+    }
+    root_path_finder_->find_k(obj, k, paths);
+  }
+
+  const ClassStats & get_class_stats() {
+    if (!class_stats_) {
+      class_stats_ = new ClassStats(this, num_threads_);
+    }
+    return *class_stats_;
+  }
+
+  // Visits objects other than roots from the largest retained size down
+  // (ties in node index order) until func returns false.
+  template<typename Func> void each_by_retained_size(Func func) {
+    build_retained_order();
+    for (size_t i = 0; i < retained_order_.size(); ++i) {
+      if (i == num_retained_sorted_) {
+        sort_retained_order(i + 1);
+      }
+      if (!func(RubyHeapObj(&store_, retained_order_[i]))) {
+        return;
+      }
+    }
+  }
 
+  // Visits every object other than roots in node index order.
   template<typename Func> void each_heap_object(Func func) {
-    for (auto obj: heap_map_) { func(obj.second); }
+    for (int32_t i = 1; i <= num_objects_; ++i) {
+      if (!store_.is_removed(i) && (store_.get_flags(i) & RUBY_T_MASK) != RUBY_T_ROOT) {
+        func(RubyHeapObj(&store_, i));
+      }
+    }
   }
 };
 
@@ -0,0 +1,219 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+
+#include "sparsehash/dense_hash_map"
+
+#include "bloom_filter.h"
+#include "class_stats.h"
+#include "graph.h"
+#include "heap_diff.h"
+#include "parallel.h"
+
+namespace harb {
+
+namespace {
+
+// Objects of one class on one side. changed counts the removed ones before
+// and the added ones after.
+struct Tally {
+  uint64_t count;
+  uint64_t memsize;
+  uint64_t changed;
+};
+
+typedef google::dense_hash_map<uint64_t, Tally> tally_map_t;
+
+// After, classes are keyed by address and objects without one by this bit
+// and their type.
+const uint64_t kAfterTypeKey = 1ULL << 63;
+
+uint64_t after_key(uint64_t klass, RubyValueType type) {
+  return klass ? klass : kAfterTypeKey | type;
+}
+
+std::vector<tally_map_t> make_tallies(unsigned num_threads) {
+  std::vector<tally_map_t> tallies(num_threads);
+  for (auto &tally : tallies) {
+    tally.set_empty_key(UINT64_MAX);
+  }
+  return tallies;
+}
+
+// Tallies the graph's objects, with is_survivor(obj) telling whether each one
+// is in the other dump.
+template<typename Func> void
+tally_before(ObjectStore *store, unsigned num_threads, std::vector<tally_map_t> &before,
+    std::vector<uint64_t> &removed, std::vector<uint64_t> &survived, Func is_survivor) {
+  parallel_ranges(store->get_num_objects(), num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    for (uint32_t i = lo + 1; i <= hi; ++i) {
+      if (store->is_removed(i)) {
+        continue;
+      }
+      RubyHeapObj obj(store, i);
+      uint64_t key = ClassStats::key_for(obj);
+      if (!key) {
+        continue;
+      }
+      Tally &tally = before[t][key];
+      tally.count++;
+      tally.memsize += obj.get_memsize();
+      if (is_survivor(obj)) {
+        survived[t]++;
+      } else {
+        tally.changed++;
+        removed[t]++;
+      }
+    }
+  });
+}
+
+// Merges both sides' tallies by class name, largest memsize growth first.
+template<typename Func> void
+build_entries(ObjectStore *store, const std::vector<tally_map_t> &before,
+    const std::vector<tally_map_t> &after, Func class_name, std::vector<HeapDiff::Entry> &result) {
+  std::map<std::string, HeapDiff::Entry> entries;
+  char buf[64];
+  for (auto &tallies : before) {
+    for (auto &it : tallies) {
+      HeapDiff::Entry &entry = entries[ClassStats::key_name(store, it.first, buf, sizeof(buf))];
+      entry.count_before += it.second.count;
+      entry.memsize_before += it.second.memsize;
+      entry.removed += it.second.changed;
+    }
+  }
+
+  for (auto &tallies : after) {
+    for (auto &it : tallies) {
+      const char *name;
+      if (it.first & kAfterTypeKey) {
+        snprintf(buf, sizeof(buf), "(%s)", RubyHeapObj::get_value_type_string(it.first & ~kAfterTypeKey));
+        name = buf;
+      } else if (!(name = class_name(it.first))) {
+        snprintf(buf, sizeof(buf), "0x%" PRIx64, it.first);
+        name = buf;
+      }
+      HeapDiff::Entry &entry = entries[name];
+      entry.count_after += it.second.count;
+      entry.memsize_after += it.second.memsize;
+      entry.added += it.second.changed;
+    }
+  }
+
+  for (auto &it : entries) {
+    result.push_back(it.second);
+    result.back().name = it.first;
+  }
+  std::stable_sort(result.begin(), result.end(), [] (const HeapDiff::Entry &a, const HeapDiff::Entry &b) {
+    return a.memsize_change() > b.memsize_change() ||
+        (a.memsize_change() == b.memsize_change() && a.count_change() > b.count_change());
+  });
+}
+
+uint64_t sum(const std::vector<uint64_t> &counts) {
+  uint64_t total = 0;
+  for (auto count : counts) {
+    total += count;
+  }
+  return total;
+}
+
+}
+
+// Each side is split into a block per thread. Objects before are looked up
+// in the other dump's sorted addresses and objects after in the graph's
+// address index, so neither side is sorted again.
+HeapDiff::HeapDiff(Graph *graph, const DumpProjection &other, unsigned num_threads)
+  : memory_usage_(0) {
+  num_threads = std::max(num_threads, 1u);
+  ObjectStore *store = graph->get_store();
+  std::vector<tally_map_t> before = make_tallies(num_threads);
+  std::vector<tally_map_t> after = make_tallies(num_threads);
+  std::vector<uint64_t> added(num_threads, 0), removed(num_threads, 0), survived(num_threads, 0);
+
+  tally_before(store, num_threads, before, removed, survived, [&] (RubyHeapObj obj) {
+    return other.contains(obj.get_addr());
+  });
+
+  parallel_ranges(other.size(), num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i) {
+      Tally &tally = after[t][after_key(other.get_class(i), other.get_type(i))];
+      tally.count++;
+      tally.memsize += other.get_memsize(i);
+      if (!graph->get_heap_object(other.get_addrs()[i])) {
+        tally.changed++;
+        added[t]++;
+      }
+    }
+  });
+
+  num_added_ = sum(added);
+  num_removed_ = sum(removed);
+  num_survived_ = sum(survived);
+  build_entries(store, before, after, [&] (uint64_t addr) {
+    return other.get_class_name(addr);
+  }, entries_);
+}
+
+HeapDiff::HeapDiff(Graph *graph, FILE *other, unsigned num_threads) {
+  num_threads = std::max(num_threads, 1u);
+  ObjectStore *store = graph->get_store();
+  uint32_t n = store->get_num_objects();
+
+  BloomFilter filter(graph->get_num_heap_objects());
+  parallel_ranges(n, num_threads, [&] (unsigned, size_t lo, size_t hi) {
+    for (uint32_t i = lo + 1; i <= hi; ++i) {
+      if (!store->is_removed(i) && (store->get_flags(i) & RUBY_T_MASK) != RUBY_T_ROOT) {
+        filter.insert(store->get_addr(i));
+      }
+    }
+  });
+
+  std::vector<uint64_t> seen(n / 64 + 1, 0);
+  memory_usage_ = filter.memory_usage() + seen.size() * sizeof(uint64_t);
+
+  std::vector<tally_map_t> after = make_tallies(num_threads);
+  std::vector<uint64_t> added(num_threads, 0);
+  std::vector<std::vector<std::pair<uint64_t, std::string>>> names(num_threads);
+  DumpProjection::stream(other, num_threads, true, [&] (unsigned t, const DumpProjection::Object &obj) {
+    Tally &tally = after[t][after_key(obj.klass, obj.type)];
+    tally.count++;
+    tally.memsize += obj.memsize;
+
+    RubyHeapObj match = filter.maybe_contains(obj.addr) ? graph->get_heap_object(obj.addr) : RubyHeapObj();
+    if (match) {
+      uint32_t i = match.get_index();
+      __atomic_fetch_or(&seen[i >> 6], 1ULL << (i & 63), __ATOMIC_RELAXED);
+    } else {
+      tally.changed++;
+      added[t]++;
+    }
+
+    if (!obj.name.empty()) {
+      names[t].push_back(std::make_pair(obj.addr, obj.name));
+    }
+  });
+
+  std::vector<tally_map_t> before = make_tallies(num_threads);
+  std::vector<uint64_t> removed(num_threads, 0), survived(num_threads, 0);
+  tally_before(store, num_threads, before, removed, survived, [&] (RubyHeapObj obj) {
+    uint32_t i = obj.get_index();
+    return (seen[i >> 6] >> (i & 63)) & 1;
+  });
+
+  std::map<uint64_t, std::string> class_names;
+  for (auto &list : names) {
+    class_names.insert(list.begin(), list.end());
+  }
+
+  num_added_ = sum(added);
+  num_removed_ = sum(removed);
+  num_survived_ = sum(survived);
+  build_entries(store, before, after, [&] (uint64_t addr) -> const char * {
+    auto it = class_names.find(addr);
+    return it != class_names.end() ? it->second.c_str() : NULL;
+  }, entries_);
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef HARB_HEAP_DIFF_H
+#define HARB_HEAP_DIFF_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "dump_projection.h"
+
+namespace harb {
+
+class Graph;
+
+// Compares the loaded dump (before) with another one (after), class by
+// class. Classes are matched by name, since the same class can live at a
+// different address in another process; objects are matched by address to
+// tell which were added, removed or survived.
+class HeapDiff {
+public:
+  struct Entry {
+    std::string name;
+    uint64_t count_before;
+    uint64_t memsize_before;
+    uint64_t count_after;
+    uint64_t memsize_after;
+    uint64_t added;
+    uint64_t removed;
+
+    int64_t count_change() const { return (int64_t) (count_after - count_before); }
+    int64_t memsize_change() const { return (int64_t) (memsize_after - memsize_before); }
+  };
+
+  // other must have been loaded with details.
+  HeapDiff(Graph *graph, const DumpProjection &other, unsigned num_threads);
+
+  // Streams the other dump once instead of loading it, for when two dumps
+  // don't fit in memory. Its objects are checked against a Bloom filter of
+  // the graph's addresses and only the maybes against the address index,
+  // which marks the graph objects that survived in a bitset. Besides the
+  // per-class tallies that's all the memory needed: about 11 bits per
+  // object in the graph (1.4GB per billion), however big the other dump.
+  HeapDiff(Graph *graph, FILE *other, unsigned num_threads);
+
+  // Largest memsize growth first.
+  const std::vector<Entry> & entries() const { return entries_; }
+
+  uint64_t get_num_added() const { return num_added_; }
+  uint64_t get_num_removed() const { return num_removed_; }
+  uint64_t get_num_survived() const { return num_survived_; }
+
+  // Bytes used to match objects when streaming.
+  size_t get_memory_usage() const { return memory_usage_; }
+
+private:
+  std::vector<Entry> entries_;
+  uint64_t num_added_;
+  uint64_t num_removed_;
+  uint64_t num_survived_;
+  size_t memory_usage_;
+};
+
+}
+
+#endif // HARB_HEAP_DIFF_H
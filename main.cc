@@ -8,17 +8,24 @@
 #include <sys/errno.h>
 #include <unistd.h>
 #include <locale.h>
+#include <limits.h>
 #include <cstdarg>
+#include <getopt.h>
+
+#include <algorithm>
+#include <thread>
 
 #include <readline/readline.h>
 #include <readline/history.h>
 
-#include <deque>
-
+#include "sparsehash/dense_hash_map"
 #include "sparsehash/sparse_hash_map"
-#include "sparsehash/sparse_hash_set"
 
+#include "dump_projection.h"
+#include "dup_strings.h"
 #include "graph.h"
+#include "heap_diff.h"
+#include "snapshot.h"
 #include "ruby_heap_obj.h"
 #include "progress.h"
 #include "output.h"
@@ -53,20 +60,40 @@ static void cmd_quit(const char *);
 static void cmd_help(const char *);
 static void cmd_print(const char *);
 static void cmd_rootpath(const char *);
+static void cmd_rootpaths(const char *);
+static void cmd_domchain(const char *);
 static void cmd_idom(const char *);
 static void cmd_dominators(const char *);
 static void cmd_summary(const char *);
 static void cmd_diff(const char *);
+static void cmd_sdiff(const char *);
+static void cmd_leaks(const char *);
+static void cmd_top(const char *);
+static void cmd_classes(const char *);
+static void cmd_retainers(const char *);
+static void cmd_sites(const char *);
+static void cmd_generations(const char *);
+static void cmd_dupstrings(const char *);
 
 command_t commands_[] = {
   { "quit", cmd_quit, "Exits the program" },
   { "print", cmd_print, "Prints heap info for the address specified" },
   { "rootpath", cmd_rootpath, "Display the root path for the object specified" },
+  { "rootpaths", cmd_rootpaths, "Display the K shortest root paths for the object specified [K]" },
+  { "domchain", cmd_domchain, "Display the dominators from the root down to the object specified" },
   { "idom", cmd_idom, "Print the immediate dominator for the object specified" },
   { "dominators", cmd_dominators, "Print all objects dominated by the object specified" },
   { "help", cmd_help, "Displays this message"},
   { "summary", cmd_summary, "Display a heap dump summary" },
-  { "diff", cmd_diff, "Diff current heap dump with specifed dump" },
+  { "diff", cmd_diff, "Print the N classes that grew most in the specified dump [N]" },
+  { "sdiff", cmd_sdiff, "Like diff, but streams the dump instead of loading it [N]" },
+  { "leaks", cmd_leaks, "Print objects allocated between two earlier dumps that survive in this one <first> <second> [N]" },
+  { "top", cmd_top, "Print the N objects retaining the most memory [N] [type|class]" },
+  { "classes", cmd_classes, "Print the N classes retaining the most memory [N]" },
+  { "retainers", cmd_retainers, "Print the class paths retaining instances of a type or class [depth]" },
+  { "generations", cmd_generations, "Print objects by GC generation, and the N classes retaining the most by old/young and generation [N] [type|class]" },
+  { "dupstrings", cmd_dupstrings, "Print the N duplicated strings wasting the most memory and what retains them [N]" },
+  { "sites", cmd_sites, "Print the N allocation sites retaining the most memory [N] [count|memsize|retained]" },
   { NULL, NULL, NULL }
 };
 
@@ -77,13 +104,13 @@ cmd_summary(const char *) {
   size_t total_size = 0;
   size_t num_heap_objects = graph_->get_num_heap_objects();
 
-  graph_->each_heap_object([&] (RubyHeapObj *obj) {
-    total_size += obj->get_memsize();
-    uint32_t type = obj->get_type();
+  graph_->each_heap_object([&] (RubyHeapObj obj) {
+    total_size += obj.get_memsize();
+    uint32_t type = obj.get_type();
     if (type_map[type]) {
-      type_map[type] += obj->get_memsize();
+      type_map[type] += obj.get_memsize();
     } else {
-      type_map[type] = obj->get_memsize();
+      type_map[type] = obj.get_memsize();
     }
   });
   fprintf(out_, "total objects: %'zu\n", num_heap_objects);
@@ -109,60 +136,502 @@ cmd_help(const char *) {
 }
 
 static void
-cmd_diff(const char *args) {
-  if (args == NULL || strlen(args) == 0) {
+print_diff(FILE *out, const HeapDiff &diff, const char *filename, size_t n) {
+  fprintf(out, "%'zu objects here, %'" PRIu64 " in %s: %'" PRIu64 " added, %'" PRIu64 " removed, %'" PRIu64 " survived\n",
+      graph_->get_num_heap_objects(), diff.get_num_added() + diff.get_num_survived(), filename,
+      diff.get_num_added(), diff.get_num_removed(), diff.get_num_survived());
+  fprintf(out, "%18s  %12s  %12s  %12s  %12s  %12s  %s\n", "memsize change", "count change",
+      "before", "after", "added", "removed", "class");
+  for (size_t i = 0; i < n && i < diff.entries().size(); ++i) {
+    const HeapDiff::Entry &entry = diff.entries()[i];
+    fprintf(out, "%'+18" PRId64 "  %'+12" PRId64 "  %'12" PRIu64 "  %'12" PRIu64 "  %'12" PRIu64 "  %'12" PRIu64 "  %s\n",
+        entry.memsize_change(), entry.count_change(), entry.count_before, entry.count_after,
+        entry.added, entry.removed, entry.name.c_str());
+  }
+}
+
+// Opens the dump named by args, which may be followed by a row count.
+static FILE *
+open_diff_args(const char *args, char *filename, size_t &n) {
+  n = 20;
+  if (sscanf(args, "%4095s %zu", filename, &n) < 1) {
     printf("error: you must specify a heap dump file\n");
+    return NULL;
+  }
+
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    printf("unable to open %s: %d\n", filename, errno);
+  }
+  return f;
+}
+
+static void
+cmd_diff(const char *args) {
+  char filename[PATH_MAX];
+  size_t n;
+  FILE *f = open_diff_args(args, filename, n);
+  if (!f) {
     return;
   }
+  DumpProjection other(f, graph_->get_num_threads(), true);
+  fclose(f);
+
+  HeapDiff diff(graph_, other, graph_->get_num_threads());
+  Output::with_handle([&](FILE *out) {
+    print_diff(out, diff, filename, n);
+  });
+}
 
-  FILE *f = fopen(args, "r");
+static void
+cmd_sdiff(const char *args) {
+  char filename[PATH_MAX];
+  size_t n;
+  FILE *f = open_diff_args(args, filename, n);
   if (!f) {
-    printf("unable to open %s: %d\n", args, errno);
     return;
   }
+  HeapDiff diff(graph_, f, graph_->get_num_threads());
+  fclose(f);
+
+  Output::with_handle([&](FILE *out) {
+    print_diff(out, diff, filename, n);
+    fprintf(out, "(matched with %'zu bytes)\n", diff.get_memory_usage());
+  });
+}
+
+static DumpProjection *
+load_projection(const char *filename) {
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    printf("unable to open %s: %d\n", filename, errno);
+    return NULL;
+  }
+  DumpProjection *projection = new DumpProjection(f, graph_->get_num_threads());
+  fclose(f);
+  return projection;
+}
 
-  char template_name[] = "harb_diff-XXXXXX";
-  int fd = mkstemp(template_name);
-  if (fd == -1) {
-    printf("unable to create tempfile: %d\n", errno);
+// The staircase diff: objects that are new in the second dump (not in the
+// first) and are still alive in the loaded one were allocated in between
+// and never freed.
+static void
+cmd_leaks(const char *args) {
+  char first_name[PATH_MAX], second_name[PATH_MAX];
+  size_t n = 20;
+  if (sscanf(args, "%4095s %4095s %zu", first_name, second_name, &n) < 2) {
+    printf("error: you must specify two earlier heap dump files\n");
     return;
   }
 
-  FILE *out = fdopen(fd, "w");
-  if (!out) {
-    printf("unable to open temp fd: %d", errno);
+  DumpProjection *first = load_projection(first_name);
+  DumpProjection *second = first ? load_projection(second_name) : NULL;
+  if (!second) {
+    delete first;
     return;
   }
 
-  Parser p(f);
-  p.parse([&] (RubyHeapObj *obj) {
-    if (!obj->is_root_object() && graph_->get_heap_object(obj->get_addr()) == NULL) {
-      const char *s = p.current_heap_object_json();
-      fprintf(out, "%s\n", s);
+  ClassStats stats(graph_, graph_->get_num_threads(), [&] (RubyHeapObj obj) {
+    return second->contains(obj.get_addr()) && !first->contains(obj.get_addr());
+  });
+
+  uint64_t count = 0, memsize = 0;
+  for (auto &entry : stats.entries()) {
+    count += entry.count;
+    memsize += entry.memsize;
+  }
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "%'zu objects in %s, %'zu in %s\n", first->size(), first_name, second->size(), second_name);
+    fprintf(out, "%'" PRIu64 " objects (%'" PRIu64 " bytes) allocated between them still alive\n", count, memsize);
+    fprintf(out, "%18s  %18s  %12s  %s\n", "retained memsize", "memsize", "count", "class");
+    for (size_t i = 0; i < n && i < stats.entries().size(); ++i) {
+      const ClassStats::Entry &entry = stats.entries()[i];
+      char buf[64];
+      fprintf(out, "%'18" PRIu64 "  %'18" PRIu64 "  %'12" PRIu64 "  %s\n", entry.retained_size,
+          entry.memsize, entry.count, ClassStats::key_name(graph_->get_store(), entry.key, buf, sizeof(buf)));
     }
   });
 
-  fclose(out);
-  fclose(f);
+  delete first;
+  delete second;
+}
+
+// Matches objects of a type (e.g. STRING) or, for any other name, objects
+// whose class has that name. An empty filter matches everything.
+static bool
+matches_type_or_class(RubyHeapObj obj, const char *filter, RubyValueType type) {
+  if (*filter == '\0') {
+    return true;
+  }
+  if (type != RUBY_T_NONE) {
+    return obj.get_type() == type;
+  }
+  RubyHeapObj klass = obj.get_class_obj();
+  return klass && klass.get_value() && strcmp(klass.get_value(), filter) == 0;
 }
 
-static RubyHeapObj *
+static void
+cmd_top(const char *args) {
+  char *filter;
+  size_t n = strtoul(args, &filter, 10);
+  if (filter == args) {
+    n = 10;
+  }
+  while (*filter == ' ') {
+    filter++;
+  }
+  RubyValueType type = *filter ? RubyHeapObj::get_value_type(filter) : RUBY_T_NONE;
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "top %'zu objects by retained memsize%s%s:\n", n, *filter ? " for " : "", filter);
+    fprintf(out, "%18s  %12s\n", "retained memsize", "objects");
+
+    size_t found = 0;
+    graph_->each_by_retained_size([&] (RubyHeapObj obj) {
+      if (found == n) {
+        return false;
+      }
+      if (matches_type_or_class(obj, filter, type)) {
+        char buf[64];
+        fprintf(out, "%'18zu  %'12zu  0x%" PRIx64 " (%s)\n", graph_->get_retained_size(obj),
+            graph_->get_retained_count(obj), obj.get_addr(), obj.get_object_summary(buf, sizeof(buf)));
+        found++;
+      }
+      return true;
+    });
+  });
+}
+
+static void
+cmd_classes(const char *args) {
+  char *end;
+  size_t n = strtoul(args, &end, 10);
+  if (end == args) {
+    n = 20;
+  }
+
+  const ClassStats &stats = graph_->get_class_stats();
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "%18s  %18s  %12s  %s\n", "retained memsize", "memsize", "count", "class");
+    for (size_t i = 0; i < n && i < stats.entries().size(); ++i) {
+      const ClassStats::Entry &entry = stats.entries()[i];
+      char buf[64];
+      fprintf(out, "%'18" PRIu64 "  %'18" PRIu64 "  %'12" PRIu64 "  %s\n", entry.retained_size,
+          entry.memsize, entry.count, ClassStats::key_name(graph_->get_store(), entry.key, buf, sizeof(buf)));
+    }
+  });
+}
+
+// Prints node's children that retain at least min_size, down to depth.
+static void
+print_retainers(FILE *out, const RetainerTree &tree, uint32_t node, size_t depth, size_t max_depth,
+    uint64_t min_size) {
+  for (auto i : tree.nodes()[node].children) {
+    const RetainerTree::Node &child = tree.nodes()[i];
+    if (child.retained_size < min_size) {
+      break;
+    }
+    char buf[64];
+    fprintf(out, "%'18" PRIu64 "  %'12" PRIu64 "  %*s%s\n", child.retained_size, child.count,
+        (int) depth * 2, "", RetainerTree::key_name(graph_->get_store(), child.key, buf, sizeof(buf)));
+    if (depth + 1 < max_depth) {
+      print_retainers(out, tree, i, depth + 1, max_depth, min_size);
+    }
+  }
+}
+
+static void
+cmd_retainers(const char *args) {
+  char filter[256];
+  size_t depth = 12;
+  if (sscanf(args, "%255s %zu", filter, &depth) < 1) {
+    printf("error: you must specify a type or class\n");
+    return;
+  }
+  RubyValueType type = RubyHeapObj::get_value_type(filter);
+
+  RetainerTree tree(graph_, [&] (RubyHeapObj obj) {
+    return matches_type_or_class(obj, filter, type);
+  }, graph_->get_num_threads());
+
+  // Branches retaining less than 1% of the total aren't worth reading.
+  const RetainerTree::Node &top = tree.nodes()[0];
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "%'" PRIu64 " instances of %s, %'" PRIu64 " not retained by another, retaining %'" PRIu64 " bytes:\n",
+        tree.get_num_instances(), filter, top.count, top.retained_size);
+    fprintf(out, "%18s  %12s  %s\n", "retained memsize", "instances", "retained by");
+    print_retainers(out, tree, 0, 0, depth, top.retained_size / 100);
+  });
+}
+
+// An allocation site, with the file and method as string offsets.
+struct Site {
+  uint64_t file;
+  uint64_t method;
+  uint32_t line;
+
+  bool operator==(const Site &other) const {
+    return file == other.file && method == other.method && line == other.line;
+  }
+};
+
+struct SiteHash {
+  size_t operator()(const Site &site) const {
+    return std::hash<uint64_t>()((site.file * 31 + site.method) * 31 + site.line);
+  }
+};
+
+// Numbers each object's allocation site from 1 in sites, 0 for objects
+// without a file.
+static void
+number_sites(ObjectStore *store, std::vector<uint32_t> &sites) {
+  google::dense_hash_map<Site, uint32_t, SiteHash> ids;
+  ids.set_empty_key(Site{ 0, 0, 0 });
+  sites.assign(store->get_num_objects() + 1, 0);
+  for (uint32_t i = 1; i <= store->get_num_objects(); ++i) {
+    Site site = { store->get_file_offset(i), store->get_method_offset(i), store->get_line(i) };
+    if (site.file) {
+      sites[i] = ids.insert(std::make_pair(site, (uint32_t) ids.size() + 1)).first->second;
+    }
+  }
+}
+
+static void
+cmd_sites(const char *args) {
+  char order[16] = "retained";
+  size_t n = 20;
+  if (sscanf(args, "%zu %15s", &n, order) < 1) {
+    sscanf(args, "%15s", order);
+  }
+
+  auto field = &ClassStats::Entry::retained_size;
+  if (strcmp(order, "count") == 0) {
+    field = &ClassStats::Entry::count;
+  } else if (strcmp(order, "memsize") == 0) {
+    field = &ClassStats::Entry::memsize;
+  } else if (strcmp(order, "retained") != 0) {
+    printf("error: sites can be ordered by count, memsize or retained\n");
+    return;
+  }
+
+  ObjectStore *store = graph_->get_store();
+  std::vector<uint32_t> sites;
+  number_sites(store, sites);
+  ClassStats stats(graph_, graph_->get_num_threads(), nullptr, [&] (RubyHeapObj obj) -> uint64_t {
+    return sites[obj.get_index()];
+  });
+  std::vector<ClassStats::Entry> entries(stats.entries());
+  std::stable_sort(entries.begin(), entries.end(), [&] (const ClassStats::Entry &a, const ClassStats::Entry &b) {
+    return a.*field > b.*field;
+  });
+
+  Output::with_handle([&](FILE *out) {
+    if (entries.empty()) {
+      fprintf(out, "no allocation sites (dump with ObjectSpace.trace_object_allocations_start)\n");
+      return;
+    }
+    fprintf(out, "%18s  %18s  %12s  %s\n", "retained memsize", "memsize", "count", "site");
+    for (size_t i = 0; i < n && i < entries.size(); ++i) {
+      const ClassStats::Entry &entry = entries[i];
+      const char *method = store->get_method(entry.sample);
+      // Every object at a site has its file, line and method.
+      fprintf(out, "%'18" PRIu64 "  %'18" PRIu64 "  %'12" PRIu64 "  %s:%u%s%s\n", entry.retained_size,
+          entry.memsize, entry.count, store->get_file(entry.sample), store->get_line(entry.sample),
+          method ? " in " : "", method ? method : "");
+    }
+  });
+}
+
+static const unsigned kNumGenerationBuckets = 10;
+
+// Groups objects into kNumGenerationBuckets even ranges of generations, then
+// breaks down the N classes retaining the most down into old and young
+// objects (those promoted to the old generation, and the rest) and into the
+// same ranges. Classes are ordered by what their old objects retain when the
+// dump has GC flags. Retained sizes only count objects not nested in another
+// of the same row, so a class's rows needn't add up to its total.
+static void
+cmd_generations(const char *args) {
+  char filter[256] = "";
+  size_t n = 20;
+  if (sscanf(args, "%zu %255s", &n, filter) < 1) {
+    sscanf(args, "%255s", filter);
+  }
+  RubyValueType type = *filter ? RubyHeapObj::get_value_type(filter) : RUBY_T_NONE;
+  auto matches = [&] (RubyHeapObj obj) {
+    return matches_type_or_class(obj, filter, type);
+  };
+
+  uint32_t min_generation = UINT32_MAX, max_generation = 0;
+  uint64_t num_old = 0;
+  graph_->each_heap_object([&] (RubyHeapObj obj) {
+    if (obj.get_generation()) {
+      min_generation = std::min(min_generation, obj.get_generation());
+      max_generation = std::max(max_generation, obj.get_generation());
+    }
+    num_old += (obj.get_flags() & RUBY_FL_GC_OLD) != 0;
+  });
+  uint32_t width = max_generation >= min_generation ?
+      (max_generation - min_generation) / kNumGenerationBuckets + 1 : 1;
+  auto bucket = [&] (RubyHeapObj obj) -> uint64_t {
+    uint32_t generation = obj.get_generation();
+    return generation ? (generation - min_generation) / width + 1 : 0;
+  };
+  auto is_old = [] (RubyHeapObj obj) {
+    return (obj.get_flags() & RUBY_FL_GC_OLD) != 0;
+  };
+
+  unsigned num_threads = graph_->get_num_threads();
+  ClassStats buckets(graph_, num_threads, matches, bucket);
+  ClassStats classes(graph_, num_threads, matches);
+  ClassStats old(graph_, num_threads, [&] (RubyHeapObj obj) {
+    return is_old(obj) && matches(obj);
+  });
+  ClassStats young(graph_, num_threads, [&] (RubyHeapObj obj) {
+    return !is_old(obj) && matches(obj);
+  });
+  // Keyed by the class's key and the bucket in the low 4 bits.
+  ClassStats class_buckets(graph_, num_threads, matches, [&] (RubyHeapObj obj) -> uint64_t {
+    uint64_t b = bucket(obj);
+    return b ? ClassStats::key_for(obj) << 4 | b : 0;
+  });
+
+  google::dense_hash_map<uint64_t, const ClassStats::Entry *> old_by_class, young_by_class;
+  old_by_class.set_empty_key(0);
+  young_by_class.set_empty_key(0);
+  for (auto &entry : old.entries()) {
+    old_by_class[entry.key] = &entry;
+  }
+  for (auto &entry : young.entries()) {
+    young_by_class[entry.key] = &entry;
+  }
+  google::dense_hash_map<uint64_t, std::vector<const ClassStats::Entry *>> buckets_by_class;
+  buckets_by_class.set_empty_key(0);
+  for (auto &entry : class_buckets.entries()) {
+    buckets_by_class[entry.key >> 4].push_back(&entry);
+  }
+
+  std::vector<ClassStats::Entry> top(classes.entries());
+  if (num_old) {
+    auto old_retained = [&] (const ClassStats::Entry &entry) -> uint64_t {
+      auto it = old_by_class.find(entry.key);
+      return it != old_by_class.end() ? it->second->retained_size : 0;
+    };
+    std::stable_sort(top.begin(), top.end(), [&] (const ClassStats::Entry &a, const ClassStats::Entry &b) {
+      return old_retained(a) > old_retained(b);
+    });
+  }
+  top.resize(std::min(n, top.size()));
+
+  Output::with_handle([&](FILE *out) {
+    auto print_row = [&] (const ClassStats::Entry &entry, const char *indent, const char *label) {
+      fprintf(out, "%'18" PRIu64 "  %'18" PRIu64 "  %'12" PRIu64 "  %s%s\n", entry.retained_size,
+          entry.memsize, entry.count, indent, label);
+    };
+    auto print_buckets = [&] (std::vector<const ClassStats::Entry *> entries, bool by_class, const char *indent) {
+      std::sort(entries.begin(), entries.end(), [] (const ClassStats::Entry *a, const ClassStats::Entry *b) {
+        return a->key < b->key;
+      });
+      for (auto entry : entries) {
+        uint32_t first = min_generation + ((by_class ? entry->key & 15 : entry->key) - 1) * width;
+        char label[32];
+        snprintf(label, sizeof(label), "%u-%u", first, std::min(first + width - 1, max_generation));
+        print_row(*entry, indent, label);
+      }
+    };
+
+    if (!max_generation) {
+      fprintf(out, "no generations (dump with ObjectSpace.trace_object_allocations_start)\n");
+    } else {
+      std::vector<const ClassStats::Entry *> entries;
+      for (auto &entry : buckets.entries()) {
+        entries.push_back(&entry);
+      }
+      fprintf(out, "%18s  %18s  %12s  %s\n", "retained memsize", "memsize", "count", "generations");
+      print_buckets(entries, false, "");
+    }
+    if (!num_old) {
+      fprintf(out, "no old objects (the dump has no GC flags)\n");
+    }
+    if (top.empty() || (!max_generation && !num_old)) {
+      return;
+    }
+
+    fprintf(out, "\n%18s  %18s  %12s  %s\n", "retained memsize", "memsize", "count", "class / old, young / generations");
+    for (auto &entry : top) {
+      char buf[64];
+      print_row(entry, "", ClassStats::key_name(graph_->get_store(), entry.key, buf, sizeof(buf)));
+      if (num_old) {
+        auto it = old_by_class.find(entry.key);
+        if (it != old_by_class.end()) {
+          print_row(*it->second, "  ", "old");
+        }
+        it = young_by_class.find(entry.key);
+        if (it != young_by_class.end()) {
+          print_row(*it->second, "  ", "young");
+        }
+      }
+      auto it = buckets_by_class.find(entry.key);
+      if (it != buckets_by_class.end()) {
+        print_buckets(it->second, true, "  ");
+      }
+    }
+  });
+}
+
+// Longest string value shown by dupstrings.
+static const int kMaxValueLength = 60;
+
+static void
+cmd_dupstrings(const char *args) {
+  size_t n = 20;
+  sscanf(args, "%zu", &n);
+
+  ObjectStore *store = graph_->get_store();
+  DupStrings dups(graph_, graph_->get_num_threads(), n);
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "%'" PRIu64 " strings, %'" PRIu64 " duplicates wasting %'" PRIu64 " bytes\n\n",
+        dups.get_num_strings(), dups.get_num_duplicates(), dups.get_wasted());
+    if (dups.entries().empty()) {
+      return;
+    }
+
+    fprintf(out, "%18s  %18s  %12s  %12s  %s\n", "wasted", "memsize", "copies", "frozen", "value");
+    for (size_t i = 0; i < n && i < dups.entries().size(); ++i) {
+      const DupStrings::Entry &entry = dups.entries()[i];
+      const char *value = store->strings().get(entry.value);
+      int length = strlen(value);
+      fprintf(out, "%'18" PRIu64 "  %'18" PRIu64 "  %'12" PRIu64 "  %'12" PRIu64 "  \"%.*s\"%s\n", entry.wasted,
+          entry.memsize, entry.count, entry.frozen, std::min(length, kMaxValueLength), value,
+          length > kMaxValueLength ? "..." : "");
+      for (auto &retainer : entry.retainers) {
+        char buf[64];
+        fprintf(out, "%18s  %18s  %'12" PRIu64 "  retained by %s\n", "", "", retainer.count,
+            RetainerTree::key_name(store, retainer.key, buf, sizeof(buf)));
+      }
+    }
+  });
+}
+
+static RubyHeapObj
 get_ruby_heap_obj_arg(const char *args) {
   if (args == NULL || strlen(args) == 0) {
     printf("error: you must specify an address\n");
-    return NULL;
+    return RubyHeapObj();
   }
 
   uint64_t addr = strtoull(args, NULL, 0);
   if (addr == 0) {
     printf("error: you must specify a valid heap address\n");
-    return NULL;
+    return RubyHeapObj();
   }
 
-  RubyHeapObj *obj = graph_->get_heap_object(addr);
+  RubyHeapObj obj = graph_->get_heap_object(addr);
   if (!obj) {
     printf("error: no ruby object found at address 0x%" PRIx64 "\n", addr);
-    return NULL;
+    return RubyHeapObj();
   }
 
   return obj;
@@ -170,104 +639,141 @@ get_ruby_heap_obj_arg(const char *args) {
 
 static void
 cmd_print(const char *args) {
-  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
+  RubyHeapObj obj = get_ruby_heap_obj_arg(args);
   if (!obj) {
     return;
   }
 
   Output::with_handle([&](FILE *out) {
-    obj->print_object(out);
+    obj.print_object(out);
   });
 }
 
 static void
 cmd_idom(const char *args) {
-  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
-  if (!obj || obj->is_root_object()) {
+  RubyHeapObj obj = get_ruby_heap_obj_arg(args);
+  if (!obj || obj.is_root_object()) {
     return;
   }
 
-  RubyHeapObj *idom = graph_->get_idom(obj);
+  RubyHeapObj idom = graph_->get_idom(obj);
 
   Output::with_handle([&](FILE *out) {
     if (idom) {
-      fprintf(out, "dominator for 0x%" PRIx64 ":\n", obj->get_addr());
-      idom->print_ref_object(out);
+      fprintf(out, "dominator for 0x%" PRIx64 ":\n", obj.get_addr());
+      idom.print_ref_object(out);
     } else {
-      fprintf(out, "could not determine dominator for 0x%" PRIx64 ": ", obj->get_addr());
+      fprintf(out, "could not determine dominator for 0x%" PRIx64 ": ", obj.get_addr());
     }
   });
 }
 
 static void
 cmd_dominators(const char * args) {
-  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
-  if (!obj || obj->is_root_object()) {
+  RubyHeapObj obj = get_ruby_heap_obj_arg(args);
+  if (!obj || obj.is_root_object()) {
     return;
   }
 
   Output::with_handle([&](FILE *out) {
-    fprintf(out, "0x%" PRIx64 " dominates:\n", obj->get_addr());
+    fprintf(out, "0x%" PRIx64 " dominates:\n", obj.get_addr());
 
-    std::vector<RubyHeapObj *> dominators;
+    std::vector<RubyHeapObj> dominators;
     graph_->get_dominators(obj, dominators);
 
     if (!dominators.empty()) {
       for (auto child : dominators) {
-        child->print_ref_object(out);
+        child.print_ref_object(out);
       }
     } else {
-      fprintf(out, "0x%" PRIx64 " does not dominate any objects\n", obj->get_addr());
+      fprintf(out, "0x%" PRIx64 " does not dominate any objects\n", obj.get_addr());
     }
   });
 }
 
 static void
 cmd_rootpath(const char *args) {
-  bool found = false;
-  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
+  RubyHeapObj obj = get_ruby_heap_obj_arg(args);
   if (!obj) {
     return;
   }
 
-  RubyHeapObj *cur;
-  std::deque<RubyHeapObj *> q;
-  google::sparse_hash_set<RubyHeapObj *> visited;
-  google::sparse_hash_map<RubyHeapObj *, RubyHeapObj *> parent;
-
-  q.push_back(obj);
-  visited.insert(obj);
+  std::vector<RubyHeapObj> path;
+  bool found = graph_->find_root_path(obj, path);
 
-  while (!q.empty() && !found) {
-    cur = q.front();
-    q.pop_front();
+  Output::with_handle([&](FILE *out) {
+    if (!found) {
+      fprintf(out, "error: could not find path to root for 0x%" PRIx64 "\n", obj.get_addr());
+      return;
+    }
 
-    for (auto ref : *(cur->get_refs_from())) {
-      if (visited.find(ref) == visited.end()) {
-        visited.insert(ref);
-        parent[ref] = cur;
-        if (ref->is_root_object()) {
-          cur = ref;
-          found = true;
-          break;
-        }
-        q.push_back(ref);
-      }
+    fprintf(out, "root path to 0x%" PRIx64 ":\n", obj.get_addr());
+    for (auto cur : path) {
+      cur.print_ref_object(out);
     }
+    fprintf(out, "\n");
+  });
+}
+
+static void
+cmd_rootpaths(const char *args) {
+  RubyHeapObj obj = get_ruby_heap_obj_arg(args);
+  if (!obj) {
+    return;
+  }
+
+  char *end;
+  strtoull(args, &end, 0);
+  size_t k = strtoul(end, &end, 10);
+  if (k == 0) {
+    k = 3;
   }
 
+  std::vector<std::vector<RubyHeapObj>> paths;
+  graph_->find_root_paths(obj, k, paths);
+
   Output::with_handle([&](FILE *out) {
-    if (!found) {
-      fprintf(out, "error: could not find path to root for 0x%" PRIx64 "\n", obj->get_addr());
+    if (paths.empty()) {
+      fprintf(out, "error: could not find path to root for 0x%" PRIx64 "\n", obj.get_addr());
       return;
     }
 
-    fprintf(out, "root path to 0x%" PRIx64 ":\n", obj->get_addr());
-    while (cur != NULL) {
-      cur->print_ref_object(out);
-      cur = parent[cur];
+    for (size_t i = 0; i < paths.size(); ++i) {
+      fprintf(out, "root path %zu to 0x%" PRIx64 " (length %zu):\n", i + 1, obj.get_addr(), paths[i].size());
+      for (auto cur : paths[i]) {
+        cur.print_ref_object(out);
+      }
+      fprintf(out, "\n");
+    }
+  });
+}
+
+static void
+cmd_domchain(const char *args) {
+  RubyHeapObj obj = get_ruby_heap_obj_arg(args);
+  if (!obj) {
+    return;
+  }
+
+  // Every object the chain passes through retains all of obj's.
+  std::vector<RubyHeapObj> chain;
+  uint32_t root = graph_->get_store()->get_root();
+  for (RubyHeapObj cur = obj; cur && cur.get_index() != root; cur = graph_->get_idom(cur)) {
+    chain.push_back(cur);
+  }
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "dominator chain to 0x%" PRIx64 ":\n", obj.get_addr());
+    fprintf(out, "%18s\n", "retained memsize");
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      char buf[64];
+      fprintf(out, "%'18zu  ", graph_->get_retained_size(*it));
+      if (it->is_root_object()) {
+        fprintf(out, "ROOT (%s)\n", it->get_root_name());
+      } else {
+        fprintf(out, "0x%" PRIx64 " (%s)\n", it->get_addr(), it->get_object_summary(buf, sizeof(buf)));
+      }
     }
-    fprintf(out, "\n");
   });
 }
 
@@ -321,18 +827,53 @@ main(int argc, char **argv) {
 
   setvbuf(stdout, NULL, _IONBF, 0);
 
-  if (argc < 2) {
+  GraphOptions options;
+  options.num_threads = std::thread::hardware_concurrency();
+  bool use_snapshot = true;
+  int opt;
+  while ((opt = getopt(argc, argv, "a:d:j:n")) != -1) {
+    switch (opt) {
+      case 'a':
+        if (!AddressIndex::parse_kind(optarg, options.address_index)) {
+          fatal_error("unknown address index %s (sorted, paged, flat or sparse)\n", optarg);
+        }
+        break;
+      case 'd':
+        if (!DominatorTree::parse_algorithm(optarg, options.dominator_algorithm)) {
+          fatal_error("unknown dominator algorithm %s (lt, snca or parallel)\n", optarg);
+        }
+        break;
+      case 'j':
+        options.num_threads = strtoul(optarg, NULL, 10);
+        break;
+      case 'n':
+        use_snapshot = false;
+        break;
+      default:
+        fatal_error("usage: %s [-n] [-j threads] [-a index] [-d algorithm] <heap_dump_file>\n", argv[0]);
+    }
+  }
+
+  if (optind >= argc) {
     fatal_error("objectspace json dump file required\n");
     return -1;
   }
 
-  const char *heap_filename = argv[1];
+  const char *heap_filename = argv[optind];
   FILE *heap_file = fopen(heap_filename, "r");
   if (!heap_file) {
     fatal_error("unable to open %s: %d\n", heap_filename, errno);
   }
 
-  graph_ = new Graph(heap_file);
+  Snapshot *snapshot = use_snapshot ? Snapshot::open(heap_filename, heap_file) : NULL;
+  if (snapshot) {
+    graph_ = new Graph(snapshot, options);
+  } else {
+    graph_ = new Graph(heap_file, options);
+    if (use_snapshot && !Snapshot::write(heap_filename, heap_file, graph_)) {
+      fprintf(stderr, "warning: unable to write snapshot %s\n", Snapshot::path_for(heap_filename).c_str());
+    }
+  }
 
   while (!exit_) {
     line = readline("harb> ");
@@ -0,0 +1,278 @@
+#include "sparsehash/dense_hash_map"
+
+#include "object_store.h"
+#include "address_index.h"
+#include "parallel.h"
+
+namespace harb {
+
+StringTable::StringTable()
+  : index_(0, Hash{this}, Eq{this}) {
+  index_.set_empty_key(kEmptyKey);
+  data_.push_back('\0');
+}
+
+// The candidate is appended to the buffer so it can be looked up by offset
+// like everything else, and dropped again if it was already there.
+uint64_t StringTable::intern(const char *str, size_t length) {
+  uint64_t offset = data_.size();
+  data_.append(str, length);
+  data_.push_back('\0');
+
+  auto it = index_.find(offset);
+  if (it != index_.end()) {
+    data_.resize(offset);
+    return *it;
+  }
+  index_.insert(offset);
+  return offset;
+}
+
+void StringTable::view(const char *data, size_t size) {
+  index_.clear();
+  data_.view(data, size);
+}
+
+ObjectStore::ObjectStore()
+  : graph_(NULL), root_(0) {
+  // Index 0
+  add(0);
+}
+
+uint32_t ObjectStore::add(uint32_t flags) {
+  uint32_t i = flags_.size();
+  addrs_.push_back(0);
+  flags_.push_back(flags);
+  class_addrs_.push_back(0);
+  memsizes_.push_back(0);
+  values_.push_back(0);
+  sizes_.push_back(0);
+  files_.push_back(0);
+  lines_.push_back(0);
+  methods_.push_back(0);
+  generations_.push_back(0);
+  if (i == 0) {
+    refs_to_offsets_.push_back(0);
+  }
+  refs_to_offsets_.push_back(ref_addrs_.size());
+  return i;
+}
+
+void ObjectStore::set_ref_addrs(uint32_t i, const uint64_t *addrs, size_t count) {
+  // Only the most recently added object can have its references replaced.
+  ref_addrs_.resize(refs_to_offsets_[i]);
+  ref_addrs_.append(addrs, count);
+  refs_to_offsets_[i + 1] = ref_addrs_.size();
+}
+
+void ObjectStore::append(ObjectStore &other) {
+  google::dense_hash_map<uint64_t, uint64_t> offsets;
+  offsets.set_empty_key(UINT64_MAX);
+  offsets[0] = 0;
+  other.strings_.each_offset([&] (uint64_t offset) {
+    offsets[offset] = strings_.intern(other.strings_.get(offset));
+  });
+
+  uint32_t n = other.get_num_objects();
+  addrs_.append(other.addrs_.data() + 1, n);
+  flags_.append(other.flags_.data() + 1, n);
+  class_addrs_.append(other.class_addrs_.data() + 1, n);
+  memsizes_.append(other.memsizes_.data() + 1, n);
+  sizes_.append(other.sizes_.data() + 1, n);
+  lines_.append(other.lines_.data() + 1, n);
+  generations_.append(other.generations_.data() + 1, n);
+  for (uint32_t i = 1; i <= n; ++i) {
+    values_.push_back(offsets[other.values_[i]]);
+    files_.push_back(offsets[other.files_[i]]);
+    methods_.push_back(offsets[other.methods_[i]]);
+  }
+
+  uint64_t base = ref_addrs_.size();
+  ref_addrs_.append(other.ref_addrs_.data(), other.ref_addrs_.size());
+  for (uint32_t i = 1; i <= n; ++i) {
+    refs_to_offsets_.push_back(base + other.refs_to_offsets_[i + 1]);
+  }
+}
+
+void ObjectStore::remove(uint32_t i) {
+  addrs_[i] = 0;
+  flags_[i] = 0;
+  class_addrs_[i] = 0;
+  memsizes_[i] = 0;
+  values_[i] = 0;
+  sizes_[i] = 0;
+  files_[i] = 0;
+  lines_[i] = 0;
+  methods_[i] = 0;
+  generations_[i] = 0;
+}
+
+// Rows are split into one contiguous block per thread. The first pass
+// resolves addresses in place and counts the references each block keeps;
+// the second packs them into refs_to_ at the block's offset, so the result
+// doesn't depend on the number of threads.
+void ObjectStore::resolve(const AddressIndex &index, unsigned num_threads) {
+  num_threads = std::max(num_threads, 1u);
+  uint32_t n = get_num_objects();
+  classes_.resize(n + 1, 0);
+
+  std::vector<uint64_t> kept(num_threads + 1, 0);
+  std::vector<uint64_t> ends(num_threads, 0);
+  parallel_ranges(n + 1, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    uint64_t count = 0;
+    for (size_t i = lo; i < hi; ++i) {
+      uint64_t begin = refs_to_offsets_[i], end = refs_to_offsets_[i + 1];
+      if (i == root_ && root_) {
+        count += root_children_.size();
+      } else if (!is_removed(i)) {
+        classes_[i] = class_addrs_[i] ? index.find(class_addrs_[i]) : 0;
+        for (uint64_t j = begin; j < end; ++j) {
+          ref_addrs_[j] = index.find(ref_addrs_[j]);
+          count += ref_addrs_[j] != 0;
+        }
+      } else {
+        for (uint64_t j = begin; j < end; ++j) {
+          ref_addrs_[j] = 0;
+        }
+      }
+    }
+    kept[t + 1] = count;
+    ends[t] = refs_to_offsets_[hi];
+  });
+  for (unsigned t = 0; t < num_threads; ++t) {
+    kept[t + 1] += kept[t];
+  }
+
+  Column<uint32_t> refs;
+  refs.resize(kept[num_threads]);
+
+  // Offsets are rewritten in place; entry i is only overwritten after it has
+  // been read as the end of row i - 1. The end of each block's last row
+  // belongs to the next block, so it was saved above.
+  parallel_ranges(n + 1, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    uint64_t k = kept[t];
+    uint64_t begin = refs_to_offsets_[lo];
+    for (size_t i = lo; i < hi; ++i) {
+      uint64_t end = i + 1 == hi ? ends[t] : refs_to_offsets_[i + 1];
+      refs_to_offsets_[i] = k;
+      if (i == root_ && root_) {
+        std::copy(root_children_.begin(), root_children_.end(), refs.data() + k);
+        k += root_children_.size();
+      } else {
+        for (uint64_t j = begin; j < end; ++j) {
+          if (ref_addrs_[j]) {
+            refs[k++] = ref_addrs_[j];
+          }
+        }
+      }
+      begin = end;
+    }
+  });
+  refs_to_offsets_[n + 1] = refs.size();
+
+  refs_to_.swap(refs);
+  class_addrs_.clear();
+  ref_addrs_.clear();
+  std::vector<uint32_t>().swap(root_children_);
+}
+
+// Each thread takes a block of source rows and counts the targets of its
+// edges into its own histogram. A prefix sum over (target, thread) then
+// gives every row its offset and every thread its place within each row,
+// so the threads fill their edges in without sharing a slot. Blocks are in
+// source order, so sources within a row come out in index order, as they
+// would from a single thread. Each edge is read once per pass.
+//
+// The histograms cost 4 bytes per object per thread, so fewer threads are
+// used when that would come to more than twice the inverse edges
+// themselves.
+void ObjectStore::add_inverse_references(unsigned num_threads) {
+  uint32_t n = get_num_objects();
+  uint64_t num_edges = refs_to_.size();
+  num_threads = std::max<uint64_t>(1, std::min<uint64_t>(num_threads, 2 * num_edges / (n + 1)));
+  refs_from_offsets_.clear();
+  refs_from_offsets_.resize(n + 2, 0);
+  refs_from_.clear();
+  refs_from_.resize(num_edges);
+
+  // Edges to each target from each thread's rows, then where in the
+  // target's row the thread writes its next one.
+  std::vector<std::vector<uint32_t>> positions(num_threads);
+  parallel_ranges(n + 1, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    std::vector<uint32_t> &counts = positions[t];
+    counts.resize(n + 1, 0);
+    for (uint64_t j = refs_to_offsets_[lo]; j < refs_to_offsets_[hi]; ++j) {
+      counts[refs_to_[j]]++;
+    }
+  });
+
+  // Row lengths and the threads' places within rows, then row offsets once
+  // the blocks' totals are known.
+  std::vector<uint64_t> totals(num_threads + 1, 0);
+  parallel_ranges(n + 1, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    uint64_t total = 0;
+    for (size_t i = lo; i < hi; ++i) {
+      uint32_t length = 0;
+      for (auto &counts : positions) {
+        if (!counts.empty()) {
+          uint32_t count = counts[i];
+          counts[i] = length;
+          length += count;
+        }
+      }
+      refs_from_offsets_[i] = length;
+      total += length;
+    }
+    totals[t + 1] = total;
+  });
+  for (unsigned t = 0; t < num_threads; ++t) {
+    totals[t + 1] += totals[t];
+  }
+  parallel_ranges(n + 1, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    uint64_t offset = totals[t];
+    for (size_t i = lo; i < hi; ++i) {
+      uint64_t length = refs_from_offsets_[i];
+      refs_from_offsets_[i] = offset;
+      offset += length;
+    }
+  });
+  refs_from_offsets_[n + 1] = num_edges;
+
+  parallel_ranges(n + 1, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    std::vector<uint32_t> &counts = positions[t];
+    for (uint32_t i = lo; i < hi; ++i) {
+      for (uint64_t j = refs_to_offsets_[i]; j < refs_to_offsets_[i + 1]; ++j) {
+        uint32_t target = refs_to_[j];
+        refs_from_[refs_from_offsets_[target] + counts[target]++] = i;
+      }
+    }
+  });
+}
+
+void ObjectStore::view(uint32_t num_objects, const uint64_t *addrs, const uint32_t *flags,
+    const uint32_t *classes, const uint64_t *memsizes, const uint64_t *values,
+    const uint32_t *sizes, const uint64_t *files, const uint32_t *lines,
+    const uint64_t *methods, const uint32_t *generations,
+    const uint64_t *refs_to_offsets, const uint32_t *refs_to,
+    const uint64_t *refs_from_offsets, const uint32_t *refs_from,
+    const char *strings, size_t strings_size) {
+  addrs_.view(addrs, num_objects + 1);
+  flags_.view(flags, num_objects + 1);
+  classes_.view(classes, num_objects + 1);
+  memsizes_.view(memsizes, num_objects + 1);
+  values_.view(values, num_objects + 1);
+  sizes_.view(sizes, num_objects + 1);
+  files_.view(files, num_objects + 1);
+  lines_.view(lines, num_objects + 1);
+  methods_.view(methods, num_objects + 1);
+  generations_.view(generations, num_objects + 1);
+  refs_to_offsets_.view(refs_to_offsets, num_objects + 2);
+  refs_to_.view(refs_to, refs_to_offsets[num_objects + 1]);
+  refs_from_offsets_.view(refs_from_offsets, num_objects + 2);
+  refs_from_.view(refs_from, refs_from_offsets[num_objects + 1]);
+  strings_.view(strings, strings_size);
+  class_addrs_.clear();
+  ref_addrs_.clear();
+}
+
+}
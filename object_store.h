@@ -0,0 +1,316 @@
+#ifndef HARB_OBJECT_STORE_H
+#define HARB_OBJECT_STORE_H
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "sparsehash/dense_hash_set"
+
+namespace harb {
+
+class AddressIndex;
+class Graph;
+
+// A growable array of plain values. It either owns its storage, which is
+// grown with realloc so large columns can be moved by remapping pages rather
+// than copying, or is a read-only view of memory owned by someone else (a
+// mapped snapshot).
+template<typename T> class Column {
+  T *data_;
+  size_t size_;
+  size_t capacity_;
+  bool owned_;
+
+public:
+  Column() : data_(NULL), size_(0), capacity_(0), owned_(true) {}
+  ~Column() { clear(); }
+
+  Column(const Column &) = delete;
+  Column & operator=(const Column &) = delete;
+
+  size_t size() const { return size_; }
+  T * data() { return data_; }
+  const T * data() const { return data_; }
+  T & operator[](size_t i) { return data_[i]; }
+  const T & operator[](size_t i) const { return data_[i]; }
+  T & back() { return data_[size_ - 1]; }
+
+  void reserve(size_t capacity) {
+    if (capacity > capacity_) {
+      T *data = (T *) realloc(data_, capacity * sizeof(T));
+      if (!data) {
+        abort();
+      }
+      data_ = data;
+      capacity_ = capacity;
+    }
+  }
+
+  void resize(size_t size, const T &value = T()) {
+    reserve(size);
+    for (size_t i = size_; i < size; ++i) {
+      data_[i] = value;
+    }
+    size_ = size;
+  }
+
+  void push_back(const T &value) {
+    if (size_ == capacity_) {
+      reserve(capacity_ ? capacity_ * 2 : 1024);
+    }
+    data_[size_++] = value;
+  }
+
+  void append(const T *values, size_t count) {
+    if (count == 0) {
+      return;
+    }
+    if (size_ + count > capacity_) {
+      reserve(std::max(size_ + count, capacity_ * 2));
+    }
+    memcpy(data_ + size_, values, count * sizeof(T));
+    size_ += count;
+  }
+
+  // Gives back unused capacity once a column is complete.
+  void shrink_to_fit() {
+    if (owned_ && size_ && size_ < capacity_) {
+      data_ = (T *) realloc(data_, size_ * sizeof(T));
+      capacity_ = size_;
+    }
+  }
+
+  void swap(Column &other) {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(owned_, other.owned_);
+  }
+
+  void clear() {
+    if (owned_) {
+      free(data_);
+    }
+    data_ = NULL;
+    size_ = capacity_ = 0;
+    owned_ = true;
+  }
+
+  void view(const T *data, size_t size) {
+    clear();
+    data_ = (T *) data;
+    size_ = capacity_ = size;
+    owned_ = false;
+  }
+};
+
+// Interned, NUL terminated strings stored back to back in one buffer and
+// referred to by their offset in it. Offset 0 is an empty string that stands
+// for "no string", so a zeroed column means no values.
+class StringTable {
+  static const uint64_t kEmptyKey = UINT64_MAX;
+
+  struct Hash {
+    const StringTable *table;
+    size_t operator()(uint64_t offset) const {
+      uint64_t h = 0xcbf29ce484222325ULL;
+      for (const char *s = table->data_.data() + offset; *s; ++s) {
+        h = (h ^ (unsigned char) *s) * 0x100000001b3ULL;
+      }
+      return h;
+    }
+  };
+
+  struct Eq {
+    const StringTable *table;
+    bool operator()(uint64_t a, uint64_t b) const {
+      if (a == b) {
+        return true;
+      } else if (a == kEmptyKey || b == kEmptyKey) {
+        return false;
+      }
+      return strcmp(table->data_.data() + a, table->data_.data() + b) == 0;
+    }
+  };
+
+  Column<char> data_;
+  google::dense_hash_set<uint64_t, Hash, Eq> index_;
+
+public:
+  StringTable();
+
+  StringTable(const StringTable &) = delete;
+  StringTable & operator=(const StringTable &) = delete;
+
+  uint64_t intern(const char *str, size_t length);
+  uint64_t intern(const char *str) { return intern(str, strlen(str)); }
+
+  const char * get(uint64_t offset) const {
+    return offset ? data_.data() + offset : NULL;
+  }
+
+  const char * data() const { return data_.data(); }
+  size_t size() const { return data_.size(); }
+
+  template<typename Func> void each_offset(Func func) const {
+    for (auto offset : index_) {
+      func(offset);
+    }
+  }
+
+  // Points the table at strings laid out by an earlier table. The result is
+  // read-only; nothing can be interned into it.
+  void view(const char *data, size_t size);
+};
+
+// Every object in the heap as a set of parallel columns indexed by node
+// index. Index 0 is never used so that it can mean "no object"; the graph
+// puts its synthetic root at index 1.
+//
+// References are stored in compressed sparse row form in both directions:
+// the targets of object i are refs_to_[refs_to_offsets_[i]] up to
+// refs_to_[refs_to_offsets_[i + 1]], and likewise for refs_from_.
+// While a dump is being parsed, classes and references are recorded as
+// addresses in class_addrs_ and ref_addrs_; resolve() swaps them for node
+// indices once every object is known.
+//
+// The references of the root object are its root children, so graph walks
+// don't need to treat it specially.
+class ObjectStore {
+  Graph *graph_;
+  StringTable strings_;
+  uint32_t root_;
+
+  Column<uint64_t> addrs_;
+  Column<uint32_t> flags_;
+  Column<uint32_t> classes_;
+  Column<uint64_t> memsizes_;
+  Column<uint64_t> values_;
+  Column<uint32_t> sizes_;
+  // Where each object was allocated, when the dump was made with allocation
+  // tracing on: file and method are string offsets, and all are 0 without.
+  Column<uint64_t> files_;
+  Column<uint32_t> lines_;
+  Column<uint64_t> methods_;
+  Column<uint32_t> generations_;
+  Column<uint64_t> refs_to_offsets_;
+  Column<uint32_t> refs_to_;
+  Column<uint64_t> refs_from_offsets_;
+  Column<uint32_t> refs_from_;
+
+  Column<uint64_t> class_addrs_;
+  Column<uint64_t> ref_addrs_;
+
+  std::vector<uint32_t> root_children_;
+
+public:
+  ObjectStore();
+
+  ObjectStore(const ObjectStore &) = delete;
+  ObjectStore & operator=(const ObjectStore &) = delete;
+
+  Graph * get_graph() { return graph_; }
+  void set_graph(Graph *graph) { graph_ = graph; }
+
+  StringTable & strings() { return strings_; }
+
+  // Highest node index in use.
+  uint32_t get_num_objects() const { return flags_.size() - 1; }
+
+  // Appends an empty object and returns its index.
+  uint32_t add(uint32_t flags);
+
+  // Appends every object of other (which must not be resolved yet),
+  // translating string offsets into this store's table.
+  void append(ObjectStore &other);
+
+  // Clears an object that has been superseded, e.g. by a later object with
+  // the same address, so it is skipped by everything else.
+  void remove(uint32_t i);
+
+  bool is_removed(uint32_t i) const { return flags_[i] == 0 && addrs_[i] == 0; }
+
+  // Replaces class and reference addresses with node indices from index.
+  // References to addresses that aren't in the dump are dropped, and the
+  // root children become the references of the root object. The result is
+  // the same for any number of threads.
+  void resolve(const AddressIndex &index, unsigned num_threads = 1);
+
+  // Builds refs_from_ from the resolved references. Sources are listed in
+  // node index order.
+  void add_inverse_references(unsigned num_threads = 1);
+
+  uint32_t get_root() const { return root_; }
+  void set_root(uint32_t i) { root_ = i; }
+  void add_root_child(uint32_t i) { root_children_.push_back(i); }
+
+  // Loading
+  uint32_t & flags(uint32_t i) { return flags_[i]; }
+  uint64_t & addr(uint32_t i) { return addrs_[i]; }
+  uint64_t & class_addr(uint32_t i) { return class_addrs_[i]; }
+  uint64_t & memsize(uint32_t i) { return memsizes_[i]; }
+  uint64_t & value(uint32_t i) { return values_[i]; }
+  uint32_t & size(uint32_t i) { return sizes_[i]; }
+  uint64_t & file(uint32_t i) { return files_[i]; }
+  uint32_t & line(uint32_t i) { return lines_[i]; }
+  uint64_t & method(uint32_t i) { return methods_[i]; }
+  uint32_t & generation(uint32_t i) { return generations_[i]; }
+  void set_ref_addrs(uint32_t i, const uint64_t *addrs, size_t count);
+
+  // Points the columns at arrays written by an earlier, resolved store.
+  void view(uint32_t num_objects, const uint64_t *addrs, const uint32_t *flags,
+      const uint32_t *classes, const uint64_t *memsizes, const uint64_t *values,
+      const uint32_t *sizes, const uint64_t *files, const uint32_t *lines,
+      const uint64_t *methods, const uint32_t *generations,
+      const uint64_t *refs_to_offsets, const uint32_t *refs_to,
+      const uint64_t *refs_from_offsets, const uint32_t *refs_from,
+      const char *strings, size_t strings_size);
+
+  // Queries
+  uint32_t get_flags(uint32_t i) const { return flags_[i]; }
+  uint64_t get_addr(uint32_t i) const { return addrs_[i]; }
+  uint32_t get_class(uint32_t i) const { return classes_[i]; }
+  uint64_t get_memsize(uint32_t i) const { return memsizes_[i]; }
+  const char * get_value(uint32_t i) const { return strings_.get(values_[i]); }
+  uint64_t get_value_offset(uint32_t i) const { return values_[i]; }
+  uint32_t get_size(uint32_t i) const { return sizes_[i]; }
+  const char * get_file(uint32_t i) const { return strings_.get(files_[i]); }
+  uint64_t get_file_offset(uint32_t i) const { return files_[i]; }
+  uint32_t get_line(uint32_t i) const { return lines_[i]; }
+  const char * get_method(uint32_t i) const { return strings_.get(methods_[i]); }
+  uint64_t get_method_offset(uint32_t i) const { return methods_[i]; }
+  uint32_t get_generation(uint32_t i) const { return generations_[i]; }
+
+  size_t get_num_refs_to(uint32_t i) const { return refs_to_offsets_[i + 1] - refs_to_offsets_[i]; }
+  const uint32_t * get_refs_to(uint32_t i) const { return refs_to_.data() + refs_to_offsets_[i]; }
+
+  size_t get_num_refs_from(uint32_t i) const { return refs_from_offsets_[i + 1] - refs_from_offsets_[i]; }
+  const uint32_t * get_refs_from(uint32_t i) const { return refs_from_.data() + refs_from_offsets_[i]; }
+
+  const Column<uint64_t> & get_addrs() const { return addrs_; }
+  const Column<uint32_t> & get_flags() const { return flags_; }
+  const Column<uint32_t> & get_classes() const { return classes_; }
+  const Column<uint64_t> & get_memsizes() const { return memsizes_; }
+  const Column<uint64_t> & get_values() const { return values_; }
+  const Column<uint32_t> & get_sizes() const { return sizes_; }
+  const Column<uint64_t> & get_files() const { return files_; }
+  const Column<uint32_t> & get_lines() const { return lines_; }
+  const Column<uint64_t> & get_methods() const { return methods_; }
+  const Column<uint32_t> & get_generations() const { return generations_; }
+  const Column<uint64_t> & get_refs_to_offsets() const { return refs_to_offsets_; }
+  const Column<uint32_t> & get_refs_to() const { return refs_to_; }
+  const Column<uint64_t> & get_refs_from_offsets() const { return refs_from_offsets_; }
+  const Column<uint32_t> & get_refs_from() const { return refs_from_; }
+
+  // Only until resolve()
+  const Column<uint64_t> & get_class_addrs() const { return class_addrs_; }
+  const Column<uint64_t> & get_ref_addrs() const { return ref_addrs_; }
+};
+
+}
+
+#endif // HARB_OBJECT_STORE_H
@@ -0,0 +1,33 @@
+#ifndef HARB_PARALLEL_H
+#define HARB_PARALLEL_H
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace harb {
+
+// Splits [0, n) into num_threads contiguous ranges and calls
+// func(thread, begin, end) for each, on its own thread. The calling thread
+// takes the first range. Returns once every range is done.
+template<typename Func> void parallel_ranges(size_t n, unsigned num_threads, Func func) {
+  num_threads = std::max(1u, (unsigned) std::min((size_t) num_threads, n));
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < num_threads; ++t) {
+    threads.push_back(std::thread([&func, t, n, num_threads] () {
+      func(t, n * t / num_threads, n * (t + 1) / num_threads);
+    }));
+  }
+  func(0, 0, n / num_threads);
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+}
+
+#endif // HARB_PARALLEL_H
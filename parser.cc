@@ -1,38 +1,556 @@
+#include <sys/stat.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "sparsehash/sparse_hash_map"
+
 #include "parser.h"
+#include "scan.h"
 
 namespace harb {
 
-Parser::Parser(FILE *f) : heap_obj_count_(0), f_(f), heap_obj_json_(NULL), heap_obj_json_size_(0) {}
+// Work is split into more chunks than threads so that a slow chunk doesn't
+// hold everything up, and so the merge can start before parsing finishes.
+static const size_t kChunksPerThread = 8;
+static const size_t kMinChunkSize = 4 * 1024 * 1024;
+
+struct Parser::Chunk {
+  const char *begin;
+  size_t size;
+  size_t offset;
+  Parser *parser;
+  ObjectStore *store;
+  bool done;
+  // Whether everything in the chunk parsed.
+  bool complete;
+};
+
+Parser::Parser(FILE *f, ObjectStore *store)
+  : store_(store), f_(f), mapped_(NULL), mapped_size_(0), owns_mapping_(false),
+    num_threads_(1), fast_path_(true) {
+  map_file();
+}
+
+// Parser over a slice of a mapping owned by another parser.
+Parser::Parser(const char *data, size_t size, ObjectStore *store)
+  : store_(store), f_(NULL), mapped_(data), mapped_size_(size), owns_mapping_(false),
+    num_threads_(1), fast_path_(true) {}
 
 Parser::~Parser() {
-  if (heap_obj_json_) {
-    free(heap_obj_json_);
-    heap_obj_json_ = NULL;
+  if (mapped_ && owns_mapping_) {
+    munmap((void *) mapped_, mapped_size_);
+    mapped_ = NULL;
+  }
+}
+
+// Maps the whole dump read-only so the reader can run over memory instead of
+// going through stdio. Falls back to the buffered file stream for anything
+// that can't be mapped (pipes, empty files).
+bool Parser::map_file() {
+  struct stat st;
+  if (fstat(fileno(f_), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    return false;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f_), 0);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+
+  mapped_ = (const char *) p;
+  mapped_size_ = st.st_size;
+  owns_mapping_ = true;
+  return true;
+}
+
+void Parser::parse_chunk(Chunk *chunk) {
+  chunk->store = new ObjectStore();
+  chunk->parser = new Parser(chunk->begin, chunk->size, chunk->store);
+  chunk->parser->fast_path_ = fast_path_;
+  chunk->parser->parse_mapped([] (RubyHeapObj) {});
+
+  const char *p = chunk->begin + chunk->parser->get_position();
+  const char *end = chunk->begin + chunk->size;
+  while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+    p++;
+  }
+  chunk->complete = p == end;
+}
+
+// Moves a parsed chunk's objects onto the end of our store, so they get the
+// indices a serial parse would have assigned, and hands them to func.
+void Parser::merge_chunk(Chunk *chunk, const std::function<void(RubyHeapObj)> &func) {
+  uint32_t first = store_->get_num_objects() + 1;
+  store_->append(*chunk->store);
+
+  delete chunk->parser;
+  delete chunk->store;
+  chunk->parser = NULL;
+  chunk->store = NULL;
+
+  handler_.obj_end_pos_ = chunk->offset + chunk->size;
+  for (uint32_t i = first; i <= store_->get_num_objects(); ++i) {
+    func(RubyHeapObj(store_, i));
+  }
+}
+
+void Parser::parse_parallel(const std::function<void(RubyHeapObj)> &func) {
+  size_t num_chunks = num_threads_ * kChunksPerThread;
+  size_t chunk_size = std::max(mapped_size_ / num_chunks, kMinChunkSize);
+
+  // Split before a line that starts with '{'. ObjectSpace.dump_all writes
+  // one object per line, and in a pretty printed dump only top level
+  // objects start at the beginning of a line.
+  std::vector<Chunk> chunks;
+  const char *end = mapped_ + mapped_size_;
+  const char *p = mapped_;
+  while (p < end) {
+    const char *q = p + std::min(chunk_size, (size_t) (end - p));
+    while (q < end && (q[-1] != '\n' || *q != '{')) {
+      q = scan::find_newline(q, end);
+      q = q < end ? q + 1 : end;
+    }
+    Chunk chunk = { p, (size_t) (q - p), (size_t) (p - mapped_), NULL, NULL, false, false };
+    chunks.push_back(chunk);
+    p = q;
+  }
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::atomic<size_t> next_chunk(0);
+  std::vector<std::thread> threads;
+
+  unsigned num_threads = std::min((size_t) num_threads_, chunks.size());
+  for (unsigned i = 0; i < num_threads; ++i) {
+    threads.push_back(std::thread([&] () {
+      size_t n;
+      while ((n = next_chunk++) < chunks.size()) {
+        parse_chunk(&chunks[n]);
+        std::lock_guard<std::mutex> lock(mutex);
+        chunks[n].done = true;
+        cond.notify_all();
+      }
+    }));
+  }
+
+  handler_.state_ = HeapDumpHandler::kStart;
+  for (auto &chunk : chunks) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [&] { return chunk.done; });
+    }
+    if (chunk.complete) {
+      merge_chunk(&chunk, func);
+      continue;
+    }
+
+    // The chunk didn't split where an object starts, or the dump is broken
+    // there. Either way the rest is parsed serially from the chunk's start,
+    // so the result is what a serial parse would give.
+    next_chunk = chunks.size();
+    Chunk rest = { chunk.begin, (size_t) (end - chunk.begin), chunk.offset, NULL, NULL, false, false };
+    parse_chunk(&rest);
+    merge_chunk(&rest, func);
+    break;
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (auto &chunk : chunks) {
+    delete chunk.parser;
+    delete chunk.store;
+  }
+  handler_.state_ = HeapDumpHandler::kFinish;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fast path
+//
+// ObjectSpace.dump_all writes one flat object per line with a fixed set of
+// keys, so most lines can be decoded without going through the generic SAX
+// handler. parse_line() handles that common shape and gives up (returning
+// NULL, with no side effects) on anything else,
+// leaving the line to rapidjson.
+///////////////////////////////////////////////////////////////////////////////
+
+static inline const char * skip_ws(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+    p++;
   }
+  return p;
 }
 
-const char * Parser::get_intern_string(const char *str) {
-  assert(str);
-  auto it = intern_strings_.find(str);
-  if (it != intern_strings_.end()) {
-    return *it;
+// p points at an opening quote. Returns a pointer just past the closing
+// quote and sets str/length to the contents, or NULL if the string contains
+// escapes (which need decoding) or runs past end.
+static inline const char * scan_plain_string(const char *p, const char *end, const char *&str, size_t &length) {
+  str = ++p;
+  p = scan::find_quote_or_backslash(p, end);
+  if (p == end || *p != '"') {
+    return NULL;
   }
-  const char *dup = strdup(str);
-  intern_strings_.insert(dup);
-  return dup;
+  length = p - str;
+  return p + 1;
 }
 
-RubyHeapObj * Parser::create_heap_object(RubyValueType type) {
-  return new RubyHeapObj(NULL, type, ++heap_obj_count_);
+// Skips a string that may contain escapes.
+static inline const char * skip_string(const char *p, const char *end) {
+  for (++p; (p = scan::find_quote_or_backslash(p, end)) < end; p += 2) {
+    if (*p == '"') {
+      return p + 1;
+    }
+  }
+  return NULL;
+}
+
+static inline const char * parse_uint(const char *p, const char *end, uint64_t &value) {
+  const char *digits = p;
+  uint64_t v = 0;
+  while (p < end && (unsigned) (*p - '0') < 10) {
+    v = v * 10 + (*p - '0');
+    p++;
+  }
+  if (p == digits || p - digits > 19) {
+    return NULL;
+  }
+  value = v;
+  return p;
+}
+
+// Skips a scalar or a (possibly nested) array of scalars. Objects are left
+// to rapidjson since the generic handler treats nested objects specially.
+static inline const char * skip_value(const char *p, const char *end) {
+  int depth = 0;
+  do {
+    p = skip_ws(p, end);
+    if (p == end) {
+      return NULL;
+    }
+    switch (*p) {
+      case '"':
+        if (!(p = skip_string(p, end))) {
+          return NULL;
+        }
+        break;
+      case '[':
+        depth++;
+        p++;
+        continue;
+      case ']':
+        if (depth == 0) {
+          return NULL;
+        }
+        depth--;
+        p++;
+        break;
+      case '{':
+      case '}':
+        return NULL;
+      default:
+        while (p < end && *p != ',' && *p != ']' && *p != '}' && *p != ' ') {
+          p++;
+        }
+        break;
+    }
+    p = skip_ws(p, end);
+    if (depth > 0 && p < end && *p == ',') {
+      p++;
+    }
+  } while (depth > 0);
+  return p;
+}
+
+// The flag bit for a key of the GC "flags" object, or 0 for keys we don't
+// keep.
+static inline uint32_t gc_flag(const char *key, size_t length) {
+  if (length == 3 && memcmp(key, "old", 3) == 0) {
+    return RUBY_FL_GC_OLD;
+  } else if (length == 6 && memcmp(key, "marked", 6) == 0) {
+    return RUBY_FL_GC_MARKED;
+  } else if (length == 12 && memcmp(key, "wb_protected", 12) == 0) {
+    return RUBY_FL_GC_WB_PROTECTED;
+  }
+  return 0;
+}
+
+// Reads the GC "flags" object at p, adding the flags that are true to flags.
+static inline const char * parse_flags(const char *p, const char *end, uint32_t &flags) {
+  const char *str;
+  size_t length;
+  p = skip_ws(p + 1, end);
+  while (p < end && *p == '"') {
+    if (!(p = scan_plain_string(p, end, str, length))) {
+      return NULL;
+    }
+    p = skip_ws(p, end);
+    if (p == end || *p != ':') {
+      return NULL;
+    }
+    p = skip_ws(p + 1, end);
+    if (end - p >= 4 && memcmp(p, "true", 4) == 0) {
+      flags |= gc_flag(str, length);
+      p += 4;
+    } else if (end - p >= 5 && memcmp(p, "false", 5) == 0) {
+      p += 5;
+    } else {
+      return NULL;
+    }
+    p = skip_ws(p, end);
+    if (p < end && *p == ',') {
+      p = skip_ws(p + 1, end);
+    }
+  }
+  if (p == end || *p != '}') {
+    return NULL;
+  }
+  return p + 1;
+}
+
+// Maps a key to the handler state that reads its value, or kInsideObject for
+// keys we don't care about.
+Parser::HeapDumpHandler::State Parser::lookup_key(const char *key, size_t length) {
+#define KEY(name, state) \
+  if (memcmp(key, name, length) == 0) return HeapDumpHandler::state
+  switch (length) {
+    case 4:
+      switch (key[0]) {
+        case 't': KEY("type", kType); break;
+        case 's': KEY("size", kSize); break;
+        case 'n': KEY("name", kName); break;
+        case 'r': KEY("root", kRoot); break;
+        case 'f': KEY("file", kFile); break;
+        case 'l': KEY("line", kLine); break;
+      }
+      break;
+    case 5:
+      switch (key[0]) {
+        case 'c': KEY("class", kClass); break;
+        case 'v': KEY("value", kValue); break;
+        case 'f': KEY("flags", kFlags); break;
+      }
+      break;
+    case 6:
+      switch (key[0]) {
+        case 'f': KEY("frozen", kFrozen); break;
+        case 's':
+          if (key[1] == 'h') { KEY("shared", kShared); } else { KEY("struct", kStruct); }
+          break;
+        case 'l': KEY("length", kLength); break;
+        case 'm': KEY("method", kMethod); break;
+      }
+      break;
+    case 7:
+      switch (key[0]) {
+        case 'a': KEY("address", kAddress); break;
+        case 'm': KEY("memsize", kMemsize); break;
+      }
+      break;
+    case 8:
+      if (key[0] == 'b') { KEY("bytesize", kLength); }
+      break;
+    case 10:
+      switch (key[0]) {
+        case 'r': KEY("references", kReferences); break;
+        case 'i': KEY("imemo_type", kStruct); break;
+        case 'g': KEY("generation", kGeneration); break;
+      }
+      break;
+  }
+#undef KEY
+  return HeapDumpHandler::kInsideObject;
+}
+
+const char * Parser::parse_line(const char *p, const char *end) {
+  if (!fast_path_ || *p != '{') {
+    return NULL;
+  }
+
+  // Everything is decoded into locals first so that bailing out part way
+  // through leaves no trace.
+  uint32_t flags = 0;
+  uint64_t addr = 0, clazz = 0, memsize = 0, size = 0, line = 0, generation = 0;
+  const char *value = NULL, *root = NULL, *file = NULL, *method = NULL;
+  size_t value_length = 0, root_length = 0, file_length = 0, method_length = 0;
+  bool has_refs = false;
+  std::vector<uint64_t> &refs = handler_.refs_to_;
+
+  const char *str;
+  size_t length;
+
+  p = skip_ws(p + 1, end);
+  while (p < end && *p == '"') {
+    if (!(p = scan_plain_string(p, end, str, length))) {
+      return NULL;
+    }
+    p = skip_ws(p, end);
+    if (p == end || *p != ':') {
+      return NULL;
+    }
+    p = skip_ws(p + 1, end);
+    if (p == end) {
+      return NULL;
+    }
+
+    HeapDumpHandler::State key = lookup_key(str, length);
+    switch (key) {
+      case HeapDumpHandler::kAddress:
+        if (!(p = scan::parse_hex_string(p, end, addr))) {
+          return NULL;
+        }
+        break;
+      case HeapDumpHandler::kClass:
+        if (!(p = scan::parse_hex_string(p, end, clazz))) {
+          return NULL;
+        }
+        break;
+      case HeapDumpHandler::kType:
+        {
+          char type[16];
+          if (*p != '"' || !(p = scan_plain_string(p, end, str, length))) {
+            return NULL;
+          }
+          if (length < sizeof(type)) {
+            memcpy(type, str, length);
+            type[length] = '\0';
+            flags |= RubyHeapObj::get_value_type(type);
+          }
+        }
+        break;
+      case HeapDumpHandler::kReferences:
+        if (*p != '[') {
+          return NULL;
+        }
+        refs.clear();
+        if (!(p = scan::parse_hex_array(p + 1, end, refs))) {
+          return NULL;
+        }
+        if (p == end || *p != ']') {
+          return NULL;
+        }
+        p++;
+        has_refs = true;
+        break;
+      case HeapDumpHandler::kValue:
+      case HeapDumpHandler::kStruct:
+      case HeapDumpHandler::kName:
+        if (*p != '"' || !(p = scan_plain_string(p, end, value, value_length))) {
+          return NULL;
+        }
+        break;
+      case HeapDumpHandler::kRoot:
+        if (*p != '"' || !(p = scan_plain_string(p, end, root, root_length))) {
+          return NULL;
+        }
+        break;
+      case HeapDumpHandler::kFile:
+        if (*p != '"' || !(p = scan_plain_string(p, end, file, file_length))) {
+          return NULL;
+        }
+        break;
+      case HeapDumpHandler::kMethod:
+        if (*p != '"' || !(p = scan_plain_string(p, end, method, method_length))) {
+          return NULL;
+        }
+        break;
+      case HeapDumpHandler::kLine:
+        if (!(p = parse_uint(p, end, line))) {
+          return NULL;
+        }
+        break;
+      case HeapDumpHandler::kGeneration:
+        if (!(p = parse_uint(p, end, generation))) {
+          return NULL;
+        }
+        break;
+      case HeapDumpHandler::kMemsize:
+        if (!(p = parse_uint(p, end, memsize))) {
+          return NULL;
+        }
+        break;
+      case HeapDumpHandler::kSize:
+      case HeapDumpHandler::kLength:
+        if (!(p = parse_uint(p, end, size))) {
+          return NULL;
+        }
+        break;
+      case HeapDumpHandler::kFrozen:
+      case HeapDumpHandler::kShared:
+        // The generic handler only expects `true` here.
+        if (end - p < 4 || memcmp(p, "true", 4) != 0) {
+          return NULL;
+        }
+        p += 4;
+        flags |= key == HeapDumpHandler::kFrozen ? RUBY_FL_FROZEN : RUBY_FL_SHARED;
+        break;
+      case HeapDumpHandler::kFlags:
+        if (*p != '{' || !(p = parse_flags(p, end, flags))) {
+          return NULL;
+        }
+        break;
+      default:
+        if (!(p = skip_value(p, end))) {
+          return NULL;
+        }
+        break;
+    }
+
+    p = skip_ws(p, end);
+    if (p < end && *p == ',') {
+      p = skip_ws(p + 1, end);
+    }
+  }
+  if (p == end || *p != '}') {
+    return NULL;
+  }
+
+  uint32_t obj = store_->add(flags);
+  store_->addr(obj) = addr;
+  store_->class_addr(obj) = clazz;
+  store_->memsize(obj) = memsize;
+  store_->size(obj) = size;
+  if (value) {
+    store_->value(obj) = intern_string(value, value_length);
+  }
+  if (root) {
+    store_->value(obj) = intern_string(root, root_length);
+  }
+  if (file) {
+    store_->file(obj) = intern_string(file, file_length);
+  }
+  store_->line(obj) = line;
+  if (method) {
+    store_->method(obj) = intern_string(method, method_length);
+  }
+  store_->generation(obj) = generation;
+  if (has_refs) {
+    store_->set_ref_addrs(obj, refs.data(), refs.size());
+  }
+
+  handler_.obj_ = obj;
+  handler_.state_ = HeapDumpHandler::kFinishObject;
+  return p + 1;
+}
+
+// Parses a single object starting at p with the generic handler.
+const char * Parser::parse_object(const char *p) {
+  rapidjson::MemoryStream ms(p, mapped_ + mapped_size_ - p);
+  handler_.state_ = HeapDumpHandler::kFinishObject;
+  if (!reader_.Parse<rapidjson::kParseStopWhenDoneFlag | rapidjson::kParseNumbersAsStringsFlag>(ms, handler_)) {
+    return NULL;
+  }
+  return p + ms.Tell();
 }
 
 bool Parser::HeapDumpHandler::StartObject() {
   switch (state_) {
     case kStart:
     case kFinishObject:
-      obj_ = parser_->create_heap_object(RUBY_T_NONE);
+      obj_ = parser_->store_->add(RUBY_T_NONE);
       state_ = kInsideObject;
-      obj_start_pos_ = stream_->Tell() - 1;
       return true;
     default:
       return true;
@@ -42,7 +560,6 @@ bool Parser::HeapDumpHandler::StartObject() {
 bool Parser::HeapDumpHandler::EndObject(rapidjson::SizeType memberCount __attribute__((unused))) {
   switch (state_) {
     case kInsideObject:
-      obj_end_pos_ = stream_->Tell();
       state_ = kFinishObject;
       return true;
     case kFlags:
@@ -56,57 +573,31 @@ bool Parser::HeapDumpHandler::EndObject(rapidjson::SizeType memberCount __attrib
 bool Parser::HeapDumpHandler::Key(const char* str, rapidjson::SizeType length, bool copy __attribute__((unused))) {
   switch (state_) {
     case kInsideObject:
-      if (strncmp(str, "address", length) == 0) {
-        state_ = kAddress;
-      } else if (strncmp(str, "type", length) == 0) {
-        state_ = kType;
-      } else if (strncmp(str, "class", length) == 0) {
-        state_ = kClass;
-      } else if (strncmp(str, "references", length) == 0) {
-        state_ = kReferences;
-      } else if (strncmp(str, "value", length) == 0) {
-        state_ = kValue;
-      } else if (strncmp(str, "memsize", length) == 0) {
-        state_ = kMemsize;
-      } else if (strncmp(str, "frozen", length) == 0) {
-        state_ = kFrozen;
-      } else if (strncmp(str, "shared", length) == 0) {
-        state_ = kShared;
-      } else if (strncmp(str, "size", length) == 0) {
-        state_ = kSize;
-      } else if (strncmp(str, "length", length) == 0) {
-        state_ = kLength;
-      } else if (strncmp(str, "flags", length) == 0) {
-        state_ = kFlags;
-      } else if (strncmp(str, "struct", length) == 0) {
-        state_ = kStruct;
-      } else if (strncmp(str, "name", length) == 0) {
-        state_ = kName;
-      } else if (strncmp(str, "imemo_type", length) == 0) {
-        state_ = kStruct;
-      } else if (strncmp(str, "root", length) == 0) {
-        state_ = kRoot;
-      }
+      state_ = lookup_key(str, length);
+      return true;
+    case kFlags:
+      gc_flag_ = gc_flag(str, length);
       return true;
     default:
       return true;
   }
 }
 
-bool Parser::HeapDumpHandler::String(const char* str, rapidjson::SizeType length __attribute__((unused)), bool copy __attribute__((unused))) {
+bool Parser::HeapDumpHandler::String(const char* str, rapidjson::SizeType length, bool copy __attribute__((unused))) {
+  ObjectStore *store = parser_->store_;
   switch (state_) {
     case kType:
-      obj_->flags |= RubyHeapObj::get_value_type(str);
+      store->flags(obj_) |= RubyHeapObj::get_value_type(str);
       state_ = kInsideObject;
       return true;
     case kAddress:
-      obj_->as.obj.addr = strtoull(str, NULL, 0);
-      assert(obj_->as.obj.addr != 0);
+      store->addr(obj_) = strtoull(str, NULL, 0);
+      assert(store->addr(obj_) != 0);
       state_ = kInsideObject;
       return true;
     case kClass:
-      obj_->as.obj.clazz.addr = strtoull(str, NULL, 0);
-      assert(obj_->as.obj.clazz.addr != 0);
+      store->class_addr(obj_) = strtoull(str, NULL, 0);
+      assert(store->class_addr(obj_) != 0);
       state_ = kInsideObject;
       return true;
     case kReferences:
@@ -120,11 +611,16 @@ bool Parser::HeapDumpHandler::String(const char* str, rapidjson::SizeType length
     case kStruct:
     case kName:
     case kImemoType:
-      obj_->as.obj.as.value = parser_->get_intern_string(str);
+    case kRoot:
+      store->value(obj_) = parser_->intern_string(str, length);
       state_ = kInsideObject;
       return true;
-    case kRoot:
-      obj_->as.root.name = parser_->get_intern_string(str);
+    case kFile:
+      store->file(obj_) = parser_->intern_string(str, length);
+      state_ = kInsideObject;
+      return true;
+    case kMethod:
+      store->method(obj_) = parser_->intern_string(str, length);
       state_ = kInsideObject;
       return true;
     default:
@@ -141,13 +637,8 @@ bool Parser::HeapDumpHandler::StartArray() {
 
 bool Parser::HeapDumpHandler::EndArray(rapidjson::SizeType elementCount) {
   if (state_ == kReferences) {
-    size_t i = 0;
     assert(refs_to_.size() == elementCount);
-    obj_->refs_to.addr = new uint64_t[refs_to_.size() + 1];
-    for (i = 0; i < refs_to_.size(); i++) {
-      obj_->refs_to.addr[i] = refs_to_[i];
-    }
-    obj_->refs_to.addr[i] = 0;
+    parser_->store_->set_ref_addrs(obj_, refs_to_.data(), refs_to_.size());
     state_ = kInsideObject;
   }
   return true;
@@ -158,6 +649,10 @@ bool Parser::HeapDumpHandler::Bool(bool b) {
 
   if (b) {
     switch (state_) {
+      case kFlags:
+        // Stays in the flags object until it ends.
+        parser_->store_->flags(obj_) |= gc_flag_;
+        return true;
       case kFrozen:
         flag |= RUBY_FL_FROZEN;
         break;
@@ -170,7 +665,7 @@ bool Parser::HeapDumpHandler::Bool(bool b) {
   }
 
   if (flag) {
-    obj_->flags |= flag;
+    parser_->store_->flags(obj_) |= flag;
     state_ = kInsideObject;
   }
 
@@ -180,12 +675,20 @@ bool Parser::HeapDumpHandler::Bool(bool b) {
 bool Parser::HeapDumpHandler::RawNumber(const char* str, rapidjson::SizeType length __attribute__((unused)), bool copy __attribute__((unused))) {
   switch (state_) {
     case kMemsize:
-      obj_->as.obj.memsize = strtoul(str, NULL, 0);
+      parser_->store_->memsize(obj_) = strtoul(str, NULL, 0);
       state_ = kInsideObject;
       return true;
     case kSize:
     case kLength:
-      obj_->as.obj.as.size = strtoul(str, NULL, 0);
+      parser_->store_->size(obj_) = strtoul(str, NULL, 0);
+      state_ = kInsideObject;
+      return true;
+    case kLine:
+      parser_->store_->line(obj_) = strtoul(str, NULL, 0);
+      state_ = kInsideObject;
+      return true;
+    case kGeneration:
+      parser_->store_->generation(obj_) = strtoul(str, NULL, 0);
       state_ = kInsideObject;
       return true;
     default:
@@ -193,27 +696,4 @@ bool Parser::HeapDumpHandler::RawNumber(const char* str, rapidjson::SizeType len
   }
 }
 
-const char * Parser::current_heap_object_json() {
-  assert (handler_.state_ != HeapDumpHandler::kFinish || handler_.state_ != HeapDumpHandler::kStart);
-
-  size_t size = handler_.obj_end_pos_ - handler_.obj_start_pos_;
-  assert (size > 0);
-  if (size > heap_obj_json_size_) {
-    if (heap_obj_json_) {
-      delete[] heap_obj_json_;
-    }
-
-    heap_obj_json_ = new char[size+1];
-    heap_obj_json_size_ = size;
-  }
-
-  off_t cur_pos = ftello(f_);
-  fseek(f_, handler_.obj_start_pos_, SEEK_SET);
-  fread(heap_obj_json_, size, 1, f_);
-  heap_obj_json_[size] = '\0';
-  fseek(f_, cur_pos, SEEK_SET);
-
-  return heap_obj_json_;
-}
-
 }
@@ -1,23 +1,23 @@
 #ifndef HARB_PARSER_H
 #define HARB_PARSER_H
 
+#include <sys/mman.h>
+
+#include <string>
 #include <vector>
+#include <functional>
 
-#include "sparsehash/sparse_hash_set"
 #include "rapidjson/reader.h"
 #include "rapidjson/filereadstream.h"
+#include "rapidjson/memorystream.h"
 
+#include "object_store.h"
 #include "ruby_heap_obj.h"
+#include "scan.h"
 
 namespace harb {
 
 class Parser {
-  struct eqstr {
-    bool operator()(const char* s1, const char* s2) const {
-      return (s1 == s2) || (s1 && s2 && strcmp(s1, s2) == 0);
-    }
-  };
-
   struct HeapDumpHandler {
       bool Null() { return true; }
       bool Bool(bool b);
@@ -53,50 +53,103 @@ class Parser {
         kStruct,
         kImemoType,
         kFlags,
-        kRoot
+        kRoot,
+        kFile,
+        kLine,
+        kMethod,
+        kGeneration
       } state_;
 
       Parser *parser_;
-      rapidjson::FileReadStream *stream_;
-      RubyHeapObj *obj_;
-      size_t obj_start_pos_, obj_end_pos_;
+      uint32_t obj_;
+      // The flag for the key last seen inside a GC "flags" object.
+      uint32_t gc_flag_;
+      size_t obj_end_pos_;
       std::vector<uint64_t> refs_to_;
   };
 
-  typedef google::sparse_hash_set<const char *, std::hash<const char *>, eqstr> StringSet;
+  struct Chunk;
 
-  int32_t heap_obj_count_;
-  StringSet intern_strings_;
+  ObjectStore *store_;
   HeapDumpHandler handler_;
   FILE *f_;
-  char *heap_obj_json_;
-  size_t heap_obj_json_size_;
+  const char *mapped_;
+  size_t mapped_size_;
+  bool owns_mapping_;
+  unsigned num_threads_;
+  bool fast_path_;
+  rapidjson::Reader reader_;
 
-  const char * get_intern_string(const char *str);
+  Parser(const char *data, size_t size, ObjectStore *store);
 
-public:
+  uint64_t intern_string(const char *str, size_t length) {
+    return store_->strings().intern(str, length);
+  }
 
-  Parser(FILE *f);
-  ~Parser();
+  static HeapDumpHandler::State lookup_key(const char *key, size_t length);
+  const char * parse_line(const char *p, const char *end);
+  const char * parse_object(const char *p);
 
-  RubyHeapObj* create_heap_object(RubyValueType type);
+  bool map_file();
 
-  int32_t get_heap_object_count() { return heap_obj_count_; }
+  void parse_chunk(Chunk *chunk);
+  void merge_chunk(Chunk *chunk, const std::function<void(RubyHeapObj)> &func);
+  void parse_parallel(const std::function<void(RubyHeapObj)> &func);
 
-  const char * current_heap_object_json();
+  // Parses the mapped dump one line at a time with the hand written
+  // parse_line(), handing anything it doesn't recognize to rapidjson.
+  template<typename Func> void parse_memory(Func func) {
+    const char *p = mapped_;
+    const char *end = mapped_ + mapped_size_;
 
-  template<typename Func> void parse(Func func) {
-    fseeko(f_, 0, SEEK_SET);
+    handler_.state_ = HeapDumpHandler::kStart;
+    handler_.parser_ = this;
+    handler_.obj_end_pos_ = 0;
+    for (;;) {
+      while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+        p++;
+      }
+      if (p == end) {
+        break;
+      }
+
+      const char *next = parse_line(p, scan::find_newline(p, end));
+      if (!next && !(next = parse_object(p))) {
+        break;
+      }
+
+      handler_.obj_end_pos_ = next - mapped_;
+      func(RubyHeapObj(store_, handler_.obj_));
+      p = next;
+    }
+    handler_.state_ = HeapDumpHandler::kFinish;
+  }
+
+  // Parses the mapping serially. Chunk parsers call this directly, since
+  // their slices aren't page aligned and the whole mapping has already been
+  // advised.
+  template<typename Func> void parse_mapped(Func func) {
+    if (fast_path_) {
+      parse_memory(func);
+    } else {
+      rapidjson::MemoryStream ms(mapped_, mapped_size_);
+      parse_stream(ms, func);
+    }
+  }
 
-    char buf[16384];
+  template<typename Stream, typename Func> void parse_stream(Stream &s, Func func) {
     rapidjson::Reader reader;
-    rapidjson::FileReadStream frs(f_, buf, sizeof(buf));
 
     handler_.state_ = HeapDumpHandler::kStart;
     handler_.parser_ = this;
-    handler_.stream_ = &frs;
-    while (reader.Parse<rapidjson::kParseStopWhenDoneFlag | rapidjson::kParseNumbersAsStringsFlag>(frs, handler_)) {
-      func(handler_.obj_);
+    handler_.obj_end_pos_ = 0;
+    for (;;) {
+      rapidjson::SkipWhitespace(s);
+      if (!reader.Parse<rapidjson::kParseStopWhenDoneFlag | rapidjson::kParseNumbersAsStringsFlag>(s, handler_)) {
+        break;
+      }
+      handler_.obj_end_pos_ = s.Tell();
+      func(RubyHeapObj(store_, handler_.obj_));
     }
 
     handler_.state_ = HeapDumpHandler::kFinish;
@@ -104,6 +157,49 @@ public:
       // TODO: something
     }
   }
+
+public:
+
+  // Objects are appended to store as they are parsed.
+  Parser(FILE *f, ObjectStore *store);
+  ~Parser();
+
+  RubyHeapObj create_heap_object(RubyValueType type) {
+    return RubyHeapObj(store_, store_->add(type));
+  }
+
+  int32_t get_heap_object_count() { return store_->get_num_objects(); }
+
+  // Mapped dumps are split at line boundaries and parsed on this many
+  // threads; objects are still delivered to the parse callback serially and
+  // in file order.
+  void set_num_threads(unsigned num_threads) { num_threads_ = num_threads ? num_threads : 1; }
+
+  // Mapped dumps go through a specialized parser for the dump_all line
+  // format unless this is turned off, in which case every object is read by
+  // the generic rapidjson handler.
+  void set_fast_path(bool fast_path) { fast_path_ = fast_path; }
+
+  // Byte offset just past the last object handed to the parse callback.
+  size_t get_position() { return handler_.obj_end_pos_; }
+
+  template<typename Func> void parse(Func func) {
+    if (mapped_) {
+      madvise((void *) mapped_, mapped_size_, MADV_SEQUENTIAL);
+      if (num_threads_ > 1) {
+        parse_parallel(func);
+      } else {
+        parse_mapped(func);
+      }
+      madvise((void *) mapped_, mapped_size_, MADV_NORMAL);
+    } else {
+      fseeko(f_, 0, SEEK_SET);
+
+      char buf[16384];
+      rapidjson::FileReadStream frs(f_, buf, sizeof(buf));
+      parse_stream(frs, func);
+    }
+  }
 };
 
 }
@@ -0,0 +1,146 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "sparsehash/dense_hash_map"
+
+#include "class_stats.h"
+#include "graph.h"
+#include "parallel.h"
+#include "retainer_tree.h"
+
+namespace harb {
+
+namespace {
+
+enum Mark : uint8_t {
+  kUnmarked = 0,
+  kAncestor,
+  kInstance
+};
+
+// A trie node and the key of one of its children.
+typedef std::pair<uint32_t, uint64_t> edge_t;
+
+struct EdgeHash {
+  size_t operator()(const edge_t &edge) const {
+    return std::hash<uint64_t>()(edge.second * 0x9e3779b97f4a7c15ULL ^ edge.first);
+  }
+};
+
+}
+
+const char * RetainerTree::key_name(ObjectStore *store, uint64_t key, char *buf, size_t buf_sz) {
+  if (key & kRootKey) {
+    const char *name = RubyHeapObj(store, key & ~kRootKey).get_root_name();
+    snprintf(buf, buf_sz, name ? "ROOT (%s)" : "ROOT", name);
+    return buf;
+  }
+  return ClassStats::key_name(store, key, buf, buf_sz);
+}
+
+RetainerTree::RetainerTree(Graph *graph, const std::function<bool(RubyHeapObj)> &matches,
+    unsigned num_threads) : num_instances_(0) {
+  num_threads = std::max(num_threads, 1u);
+  ObjectStore *store = &graph->store_;
+  DominatorTree *tree = graph->dominator_tree_;
+  const uint32_t *idoms = tree->get_idoms();
+  uint32_t n = graph->num_objects_;
+
+  std::vector<uint8_t> marks(n + 1, kUnmarked);
+  std::vector<std::vector<uint32_t>> instances(num_threads);
+  parallel_ranges(n, num_threads, [&] (unsigned t, size_t lo, size_t hi) {
+    for (uint32_t i = lo + 1; i <= hi; ++i) {
+      if (store->is_removed(i) || !idoms[i]) {
+        continue;
+      }
+      RubyHeapObj obj(store, i);
+      if (!obj.is_root_object() && matches(obj)) {
+        marks[i] = kInstance;
+        instances[t].push_back(i);
+      }
+    }
+  });
+
+  // Whoever marks a node first also marks the rest of its chain.
+  parallel_ranges(num_threads, num_threads, [&] (unsigned t, size_t, size_t) {
+    for (auto i : instances[t]) {
+      for (uint32_t v = idoms[i]; v; v = idoms[v]) {
+        uint8_t expected = kUnmarked;
+        if (!__atomic_compare_exchange_n(&marks[v], &expected, (uint8_t) kAncestor, false,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+          break;
+        }
+      }
+    }
+  });
+
+  // Marked nodes below an instance are nested in it and left out.
+  std::vector<uint32_t> trie(n + 1, 0);
+  std::vector<char> nested(n + 1, 0);
+  google::dense_hash_map<edge_t, uint32_t, EdgeHash> edges;
+  edges.set_empty_key(edge_t(UINT32_MAX, UINT64_MAX));
+
+  Node top = { 0, 0, 0, 0, std::vector<uint32_t>() };
+  nodes_.push_back(top);
+  const uint32_t *order = tree->get_order();
+  for (int32_t i = 2; i <= tree->get_num_reachable(); ++i) {
+    uint32_t v = order[i];
+    uint32_t p = idoms[v];
+    if (!marks[v]) {
+      continue;
+    }
+    nested[v] = nested[p] || marks[p] == kInstance;
+    if (nested[v]) {
+      continue;
+    }
+
+    RubyHeapObj obj(store, v);
+    uint64_t key = obj.is_root_object() ? kRootKey | v : ClassStats::key_for(obj);
+    uint32_t parent = trie[p];
+    if (parent && nodes_[parent].key == key) {
+      trie[v] = parent;
+      continue;
+    }
+
+    auto it = edges.find(edge_t(parent, key));
+    if (it != edges.end()) {
+      trie[v] = it->second;
+    } else {
+      Node node = { parent, key, 0, 0, std::vector<uint32_t>() };
+      trie[v] = nodes_.size();
+      edges[edge_t(parent, key)] = nodes_.size();
+      nodes_.push_back(node);
+    }
+  }
+
+  parallel_ranges(num_threads, num_threads, [&] (unsigned t, size_t, size_t) {
+    for (auto i : instances[t]) {
+      if (!nested[i]) {
+        Node &node = nodes_[trie[i]];
+        __atomic_fetch_add(&node.count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&node.retained_size, tree->get_retained_size(RubyHeapObj(store, i)),
+            __ATOMIC_RELAXED);
+      }
+    }
+  });
+  for (auto &list : instances) {
+    num_instances_ += list.size();
+  }
+
+  for (size_t i = nodes_.size() - 1; i > 0; --i) {
+    nodes_[nodes_[i].parent].count += nodes_[i].count;
+    nodes_[nodes_[i].parent].retained_size += nodes_[i].retained_size;
+  }
+  for (size_t i = 1; i < nodes_.size(); ++i) {
+    nodes_[nodes_[i].parent].children.push_back(i);
+  }
+  for (auto &node : nodes_) {
+    std::stable_sort(node.children.begin(), node.children.end(), [&] (uint32_t a, uint32_t b) {
+      return nodes_[a].retained_size > nodes_[b].retained_size;
+    });
+  }
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef HARB_RETAINER_TREE_H
+#define HARB_RETAINER_TREE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <functional>
+#include <vector>
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+class Graph;
+
+// Why the instances of a class are retained: the dominator chain of each
+// instance, from the root down, turned into a path of the classes along it
+// and merged into a trie. Runs of the same class are collapsed into one
+// step, so a Hash of Hashes reads as a single Hash. Only instances no other
+// instance dominates are summarized, since they retain the nested ones.
+//
+// Chains share most of their ancestors, so each dominator is only visited
+// once: threads mark the chains of their instances upwards and stop at the
+// first node already marked, then the marked nodes are given trie nodes in
+// DFS preorder, parents first.
+class RetainerTree {
+public:
+  // Keys of root objects are kRootKey | their node index; other keys are
+  // ClassStats keys.
+  static const uint64_t kRootKey = 1ULL << 33;
+
+  struct Node {
+    uint32_t parent;
+    uint64_t key;
+    // Instances at or below the node, and the memory they retain.
+    uint64_t count;
+    uint64_t retained_size;
+    // Largest retained size first.
+    std::vector<uint32_t> children;
+  };
+
+  // Summarizes the objects matches accepts, splitting the work over
+  // num_threads.
+  RetainerTree(Graph *graph, const std::function<bool(RubyHeapObj)> &matches, unsigned num_threads);
+
+  // Node 0 is the root; every other node comes after its parent.
+  const std::vector<Node> & nodes() const { return nodes_; }
+
+  // Matching objects, and how many of them are summarized.
+  uint64_t get_num_instances() const { return num_instances_; }
+  uint64_t get_num_outermost() const { return nodes_[0].count; }
+
+  // The root's name for root keys, otherwise see ClassStats::key_name.
+  static const char * key_name(ObjectStore *store, uint64_t key, char *buf, size_t buf_sz);
+
+private:
+  std::vector<Node> nodes_;
+  uint64_t num_instances_;
+};
+
+}
+
+#endif // HARB_RETAINER_TREE_H
@@ -0,0 +1,188 @@
+#include <algorithm>
+
+#include "root_path.h"
+
+namespace harb {
+
+RootPathFinder::RootPathFinder(ObjectStore *store, RubyHeapObj root)
+  : store_(store), root_(root) {
+  uint32_t n = store->get_num_objects();
+  for (NodeSet *set : { &forward_.visited, &backward_.visited, &blocked_ }) {
+    set->bits.assign(n / 64 + 1, 0);
+  }
+  forward_.parent.resize(n + 1);
+  backward_.parent.resize(n + 1);
+}
+
+void RootPathFinder::NodeSet::clear() {
+  for (auto i : touched) {
+    bits[i >> 6] &= ~(1ULL << (i & 63));
+  }
+  touched.clear();
+}
+
+void RootPathFinder::Side::reset() {
+  visited.clear();
+  frontier.clear();
+}
+
+size_t RootPathFinder::distance(const Side &side, uint32_t i) {
+  size_t d = 0;
+  for (; side.parent[i] != i; i = side.parent[i]) {
+    d++;
+  }
+  return d;
+}
+
+bool RootPathFinder::is_blocked_edge(uint32_t u, uint32_t v) const {
+  for (auto &edge : blocked_edges_) {
+    if (edge.first == u && edge.second == v) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The whole level is expanded even after the two sides meet, since a node
+// further down the level may be closer to the other side's start.
+uint32_t RootPathFinder::expand(Side &from, Side &to, bool forward) {
+  std::vector<uint32_t> next;
+  uint32_t best = 0;
+  size_t best_distance = SIZE_MAX;
+  for (auto u : from.frontier) {
+    const uint32_t *refs = forward ? store_->get_refs_to(u) : store_->get_refs_from(u);
+    size_t n = forward ? store_->get_num_refs_to(u) : store_->get_num_refs_from(u);
+    for (size_t j = 0; j < n; ++j) {
+      uint32_t v = refs[j];
+      if (from.visited.contains(v) || blocked_.contains(v)) {
+        continue;
+      }
+      if (!blocked_edges_.empty() && (forward ? is_blocked_edge(u, v) : is_blocked_edge(v, u))) {
+        continue;
+      }
+      from.visit(v, u);
+      next.push_back(v);
+      if (to.visited.contains(v)) {
+        size_t d = distance(to, v);
+        if (d < best_distance) {
+          best = v;
+          best_distance = d;
+        }
+      }
+    }
+  }
+  from.frontier.swap(next);
+  return best;
+}
+
+bool RootPathFinder::search(uint32_t source, uint32_t target, std::vector<uint32_t> &path) {
+  path.clear();
+  if (source == target) {
+    path.push_back(source);
+    return true;
+  }
+
+  forward_.visit(source, source);
+  forward_.frontier.push_back(source);
+  backward_.visit(target, target);
+  backward_.frontier.push_back(target);
+
+  uint32_t meet = 0;
+  while (!meet && !forward_.frontier.empty() && !backward_.frontier.empty()) {
+    if (forward_.frontier.size() <= backward_.frontier.size()) {
+      meet = expand(forward_, backward_, true);
+    } else {
+      meet = expand(backward_, forward_, false);
+    }
+  }
+
+  if (meet) {
+    for (uint32_t i = meet; i != source; i = forward_.parent[i]) {
+      path.push_back(i);
+    }
+    path.push_back(source);
+    std::reverse(path.begin(), path.end());
+    for (uint32_t i = meet; i != target;) {
+      i = backward_.parent[i];
+      path.push_back(i);
+    }
+  }
+
+  forward_.reset();
+  backward_.reset();
+  return meet != 0;
+}
+
+bool RootPathFinder::find(RubyHeapObj obj, std::vector<RubyHeapObj> &path) {
+  std::vector<uint32_t> indices;
+  path.clear();
+  if (!search(root_.get_index(), obj.get_index(), indices)) {
+    return false;
+  }
+  for (size_t i = 1; i < indices.size(); ++i) {
+    path.push_back(RubyHeapObj(store_, indices[i]));
+  }
+  return true;
+}
+
+// Each new path is the shortest that leaves the last one found at some
+// node (the spur) and then goes its own way: the nodes before the spur are
+// blocked so the path stays simple, and so is the next edge of every path
+// found so far that shares the same prefix, so it's a new path. Of all the
+// candidates collected so far, the shortest becomes the next path.
+void RootPathFinder::find_k(RubyHeapObj obj, size_t k, std::vector<std::vector<RubyHeapObj>> &paths) {
+  paths.clear();
+  uint32_t target = obj.get_index();
+  std::vector<std::vector<uint32_t>> found;
+  std::vector<std::vector<uint32_t>> candidates;
+  std::vector<uint32_t> spur_path;
+  if (k == 0 || !search(root_.get_index(), target, spur_path)) {
+    return;
+  }
+  found.push_back(spur_path);
+
+  while (found.size() < k) {
+    const std::vector<uint32_t> last = found.back();
+    for (size_t i = 0; i + 1 < last.size(); ++i) {
+      for (auto &p : found) {
+        if (p.size() > i + 1 && std::equal(last.begin(), last.begin() + i + 1, p.begin())) {
+          blocked_edges_.push_back(std::make_pair(p[i], p[i + 1]));
+        }
+      }
+      for (size_t j = 0; j < i; ++j) {
+        blocked_.insert(last[j]);
+      }
+
+      if (search(last[i], target, spur_path)) {
+        std::vector<uint32_t> candidate(last.begin(), last.begin() + i);
+        candidate.insert(candidate.end(), spur_path.begin(), spur_path.end());
+        if (std::find(candidates.begin(), candidates.end(), candidate) == candidates.end() &&
+            std::find(found.begin(), found.end(), candidate) == found.end()) {
+          candidates.push_back(candidate);
+        }
+      }
+
+      blocked_.clear();
+      blocked_edges_.clear();
+    }
+
+    if (candidates.empty()) {
+      break;
+    }
+    auto best = std::min_element(candidates.begin(), candidates.end(),
+        [] (const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+      return a.size() < b.size() || (a.size() == b.size() && a < b);
+    });
+    found.push_back(*best);
+    candidates.erase(best);
+  }
+
+  for (auto &p : found) {
+    paths.push_back(std::vector<RubyHeapObj>());
+    for (size_t i = 1; i < p.size(); ++i) {
+      paths.back().push_back(RubyHeapObj(store_, p[i]));
+    }
+  }
+}
+
+}
@@ -0,0 +1,87 @@
+#ifndef HARB_ROOT_PATH_H
+#define HARB_ROOT_PATH_H
+
+#include <inttypes.h>
+
+#include <vector>
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+// Finds shortest reference paths from the roots to an object. The search
+// is a bidirectional breadth first search over node indices: forwards along
+// references from the root and backwards along inverse references from the
+// object, a level at a time from whichever side has the smaller frontier.
+// Visited sets are bitsets and parents flat arrays, allocated once and
+// reused by every query; only the bits a query set are cleared after it.
+//
+// The k shortest paths come from Yen's algorithm, which reruns the search
+// from each node of the paths found so far with the nodes before it and
+// the edges already taken from it blocked.
+class RootPathFinder {
+public:
+  RootPathFinder(ObjectStore *store, RubyHeapObj root);
+
+  // Fills path with a shortest path from a root object (a child of the
+  // root) to obj, root object first. Returns false if obj isn't reachable.
+  bool find(RubyHeapObj obj, std::vector<RubyHeapObj> &path);
+
+  // Fills paths with up to k distinct paths to obj that don't visit any
+  // object twice, shortest first, each laid out like find's.
+  void find_k(RubyHeapObj obj, size_t k, std::vector<std::vector<RubyHeapObj>> &paths);
+
+private:
+  // A set of node indices that remembers which bits it set, so clearing it
+  // costs as much as filling it did.
+  struct NodeSet {
+    std::vector<uint64_t> bits;
+    std::vector<uint32_t> touched;
+
+    bool contains(uint32_t i) const { return bits[i >> 6] & (1ULL << (i & 63)); }
+    void insert(uint32_t i) {
+      bits[i >> 6] |= 1ULL << (i & 63);
+      touched.push_back(i);
+    }
+    void clear();
+  };
+
+  // Bidirectional search state for one direction.
+  struct Side {
+    NodeSet visited;
+    // The node each visited node was reached from.
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> frontier;
+
+    void visit(uint32_t i, uint32_t from) {
+      visited.insert(i);
+      parent[i] = from;
+    }
+    void reset();
+  };
+
+  ObjectStore *store_;
+  RubyHeapObj root_;
+  Side forward_;
+  Side backward_;
+
+  // Nodes and edges searches avoid.
+  NodeSet blocked_;
+  std::vector<std::pair<uint32_t, uint32_t>> blocked_edges_;
+
+  // Fills path with a shortest path from source to target, both included.
+  bool search(uint32_t source, uint32_t target, std::vector<uint32_t> &path);
+
+  // Expands from's frontier by a level. Returns the node where it best
+  // meets to, or 0 if it doesn't.
+  uint32_t expand(Side &from, Side &to, bool forward);
+
+  bool is_blocked_edge(uint32_t u, uint32_t v) const;
+
+  // Number of steps from i back to where the side's search started.
+  static size_t distance(const Side &side, uint32_t i);
+};
+
+}
+
+#endif // HARB_ROOT_PATH_H
@@ -5,16 +5,6 @@
 
 namespace harb {
 
-RubyHeapObj::RubyHeapObj(Graph *graph, RubyValueType t, int32_t idx)
-  : flags(t), idx(idx), graph(graph) {
-  refs_to.addr = NULL;
-  as.obj.clazz.addr = 0;
-
-  if (t == RUBY_T_ROOT) {
-    as.root.children = new RubyHeapObjList();
-  }
-}
-
 RubyValueType RubyHeapObj::get_value_type(const char *type) {
   assert(type);
   if (strcmp(type, "OBJECT") == 0) {
@@ -135,7 +125,8 @@ const char * RubyHeapObj::get_value_type_string(uint32_t type) {
   return "NONE";
 }
 
-const char * RubyHeapObj::get_object_summary(char *buf, size_t buf_sz) {
+const char * RubyHeapObj::get_object_summary(char *buf, size_t buf_sz) const {
+  uint32_t flags = get_flags();
   uint32_t type = flags & RUBY_T_MASK;
   if (type == RUBY_T_ROOT) {
     return "ROOT";
@@ -146,9 +137,9 @@ const char * RubyHeapObj::get_object_summary(char *buf, size_t buf_sz) {
   if (type == RUBY_T_ARRAY || type == RUBY_T_HASH) {
     sprintf(value_buf, "size %d", get_size());
   } else if (type == RUBY_T_OBJECT || type == RUBY_T_ICLASS) {
-    value_bufp = get_class_obj()->get_value();
+    value_bufp = get_class_obj() ? get_class_obj().get_value() : NULL;
   } else if (type == RUBY_T_STRING && flags & RUBY_FL_SHARED) {
-    value_bufp = get_refs_to(0)->get_value();
+    value_bufp = has_refs_to() ? get_refs_to(0).get_value() : NULL;
   } else {
     value_bufp = get_value();
   }
@@ -167,7 +158,7 @@ const char * RubyHeapObj::get_object_summary(char *buf, size_t buf_sz) {
   return buf;
 }
 
-void RubyHeapObj::print_ref_object(FILE *out) {
+void RubyHeapObj::print_ref_object(FILE *out) const {
   char buf[64];
   if (is_root_object()) {
     fprintf(out, "%20s  ROOT (%s)\n", "", get_root_name());
@@ -176,7 +167,8 @@ void RubyHeapObj::print_ref_object(FILE *out) {
   }
 }
 
-void RubyHeapObj::print_object(FILE *out) {
+void RubyHeapObj::print_object(FILE *out) const {
+  uint32_t flags = get_flags();
   uint32_t type = flags & RUBY_T_MASK;
   if (type == RUBY_T_ROOT) {
     fprintf(out, "ROOT (%s)\n", get_root_name());
@@ -191,7 +183,7 @@ void RubyHeapObj::print_object(FILE *out) {
       p = get_value();
     } else if (type == RUBY_T_OBJECT || type == RUBY_T_ICLASS) {
       name_title = type == RUBY_T_OBJECT ? "class" : "name";
-      p = get_class_obj()->get_value();
+      p = get_class_obj() ? get_class_obj().get_value() : NULL;
     } else if (type == RUBY_T_STRING || type == RUBY_T_SYMBOL) {
       name_title = "value";
       p = get_value();
@@ -215,7 +207,9 @@ void RubyHeapObj::print_object(FILE *out) {
 
     fprintf(out, "%18s: %'zu\n", "memsize", get_memsize());
 
-    fprintf(out, "%18s: %'zu\n", "retained memsize", graph->get_retained_size(this));
+    fprintf(out, "%18s: %'zu\n", "retained memsize", store_->get_graph()->get_retained_size(*this));
+
+    fprintf(out, "%18s: %'zu\n", "retained objects", store_->get_graph()->get_retained_count(*this));
 
     if (flags & RUBY_FL_SHARED) {
       fprintf(out, "%18s: %s\n", "shared", "true");
@@ -225,17 +219,30 @@ void RubyHeapObj::print_object(FILE *out) {
       fprintf(out, "%18s: %s\n", "frozen", "true");
     }
 
+    if (flags & RUBY_FL_GC_OLD) {
+      fprintf(out, "%18s: %s\n", "old", "true");
+    }
+
+    if (get_file()) {
+      fprintf(out, "%18s: %s:%u%s%s\n", "allocated at", get_file(), get_line(),
+          get_method() ? " in " : "", get_method() ? get_method() : "");
+    }
+
+    if (get_generation()) {
+      fprintf(out, "%18s: %u\n", "generation", get_generation());
+    }
+
     if (has_refs_to()) {
       fprintf(out, "%18s: [\n", "references to");
-      for (uint32_t i = 0; refs_to.obj[i]; ++i) {
-        refs_to.obj[i]->print_ref_object(out);
+      for (size_t i = 0; i < get_num_refs_to(); ++i) {
+        get_refs_to(i).print_ref_object(out);
       }
       fprintf(out, "%18s  ]\n", "");
     }
-    if (refs_from.size() > 0) {
+    if (get_num_refs_from() > 0) {
       fprintf(out, "%18s: [\n", "referenced from");
-      for (auto it = refs_from.begin(); it != refs_from.end(); ++it) {
-        (*it)->print_ref_object(out);
+      for (size_t i = 0; i < get_num_refs_from(); ++i) {
+        get_refs_from(i).print_ref_object(out);
       }
       fprintf(out, "%18s  ]\n", "");
     }
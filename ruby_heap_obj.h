@@ -6,6 +6,8 @@
 
 #include <vector>
 
+#include "object_store.h"
+
 namespace harb {
 
 enum RubyValueType {
@@ -56,83 +58,70 @@ enum RubyFlagType {
 };
 
 class RubyHeapObj;
-class Graph;
-class Parser;
 
-typedef std::vector<RubyHeapObj *> RubyHeapObjList;
+typedef std::vector<RubyHeapObj> RubyHeapObjList;
 typedef std::vector<uint64_t> RubyHeapAddrList;
 
+// A reference to one object in an ObjectStore. Handles are two words, are
+// passed by value and compare equal when they name the same object; a
+// default constructed handle names no object and tests false.
 class RubyHeapObj {
 private:
-  friend class Graph;
-  friend class Parser;
-
-  uint32_t flags;
-  uint32_t idx; // unique node index
-
-  Graph *graph;
-
-  union {
-    uint64_t *addr;
-    RubyHeapObj **obj;
-  } refs_to;
-  RubyHeapObjList refs_from;
-
-  union {
-  struct {
-    uint64_t addr;
-    union {
-      uint64_t addr;
-      RubyHeapObj *obj;
-    } clazz;
-    size_t memsize;
-    union {
-      const char *value;
-      uint32_t size;
-    } as;
-  } obj;
-  struct {
-    const char *name;
-    RubyHeapObjList *children; // only used by the root_ object
-  } root;
-  } as;
+  ObjectStore *store_;
+  uint32_t idx_;
 
 public:
-  RubyHeapObj(Graph *graph, RubyValueType t, int32_t idx);
+  RubyHeapObj() : store_(NULL), idx_(0) {}
+  RubyHeapObj(ObjectStore *store, uint32_t idx) : store_(store), idx_(idx) {}
+
+  explicit operator bool() const { return idx_ != 0; }
+
+  bool operator==(const RubyHeapObj &other) const { return idx_ == other.idx_ && store_ == other.store_; }
+  bool operator!=(const RubyHeapObj &other) const { return !(*this == other); }
+
+  ObjectStore * get_store() const { return store_; }
+
+  bool is_root_object() const { return get_type() == RUBY_T_ROOT; }
+
+  uint32_t get_flags() const { return store_->get_flags(idx_); }
 
-  bool is_root_object() { return (flags & RUBY_T_MASK) == RUBY_T_ROOT; }
+  uint32_t get_index() const { return idx_; }
 
-  uint32_t get_flags() { return flags; }
+  RubyValueType get_type() const { return (RubyValueType) (get_flags() & RUBY_T_MASK); }
 
-  uint32_t get_index() { return idx; }
+  bool has_refs_to() const { return get_num_refs_to() != 0; }
 
-  RubyValueType get_type() { return (RubyValueType) (flags & RUBY_T_MASK); }
+  size_t get_num_refs_to() const { return store_->get_num_refs_to(idx_); }
 
-  bool has_refs_to() { return refs_to.obj != NULL; }
+  RubyHeapObj get_refs_to(size_t index) const { return RubyHeapObj(store_, store_->get_refs_to(idx_)[index]); }
 
-  RubyHeapObj * get_refs_to(size_t index) { return refs_to.obj[index]; }
+  size_t get_num_refs_from() const { return store_->get_num_refs_from(idx_); }
 
-  const RubyHeapObjList * get_refs_from() { return &refs_from; }
+  RubyHeapObj get_refs_from(size_t index) const { return RubyHeapObj(store_, store_->get_refs_from(idx_)[index]); }
 
-  uint64_t get_addr() { return as.obj.addr; }
+  uint64_t get_addr() const { return store_->get_addr(idx_); }
 
-  RubyHeapObj * get_class_obj() { return as.obj.clazz.obj; }
+  RubyHeapObj get_class_obj() const { return RubyHeapObj(store_, store_->get_class(idx_)); }
 
-  size_t get_memsize() { return as.obj.memsize; }
+  size_t get_memsize() const { return store_->get_memsize(idx_); }
 
-  const char * get_value() { return as.obj.as.value; }
+  const char * get_value() const { return store_->get_value(idx_); }
 
-  uint32_t get_size() { return as.obj.as.size; }
+  uint32_t get_size() const { return store_->get_size(idx_); }
 
-  const char * get_root_name() { return as.root.name; }
+  // Allocation site and GC generation, with allocation tracing.
+  const char * get_file() const { return store_->get_file(idx_); }
+  uint32_t get_line() const { return store_->get_line(idx_); }
+  const char * get_method() const { return store_->get_method(idx_); }
+  uint32_t get_generation() const { return store_->get_generation(idx_); }
 
-  const RubyHeapObjList * get_root_children() { return as.root.children; }
+  const char * get_root_name() const { return store_->get_value(idx_); }
 
-  const char * get_object_summary(char *buf, size_t buf_sz);
+  const char * get_object_summary(char *buf, size_t buf_sz) const;
 
-  void print_ref_object(FILE *);
+  void print_ref_object(FILE *) const;
 
-  void print_object(FILE *);
+  void print_object(FILE *) const;
 
   static RubyValueType get_value_type(const char *str);
   static const char * get_value_type_string(uint32_t type);
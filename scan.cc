@@ -0,0 +1,282 @@
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HARB_SCAN_X86 1
+#endif
+
+#include "scan.h"
+
+namespace harb {
+namespace scan {
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar
+///////////////////////////////////////////////////////////////////////////////
+
+static const int8_t kHexValues[256] = {
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+static const char * find_newline_scalar(const char *p, const char *end) {
+  const char *q = (const char *) memchr(p, '\n', end - p);
+  return q ? q : end;
+}
+
+static inline const char * find_quote_or_backslash_tail(const char *p, const char *end) {
+  while (p < end && *p != '"' && *p != '\\') {
+    p++;
+  }
+  return p;
+}
+
+static const char * find_quote_or_backslash_scalar(const char *p, const char *end) {
+  return find_quote_or_backslash_tail(p, end);
+}
+
+// p points at the first digit, returns the number of digits decoded.
+static inline int decode_hex_scalar(const char *p, const char *end, uint64_t &value) {
+  uint64_t v = 0;
+  int n = 0;
+  int8_t d;
+  while (p + n < end && n <= 16 && (d = kHexValues[(unsigned char) p[n]]) >= 0) {
+    v = (v << 4) | d;
+    n++;
+  }
+  value = v;
+  return n;
+}
+
+// Shared driver for a single "0x..." string. Decode16 looks at exactly 16
+// bytes starting at the first digit, so it is only used when there is room
+// for 16 digits plus the closing quote.
+template<int (*Decode16)(const char *, uint64_t &)>
+static inline __attribute__((always_inline))
+const char * parse_hex_string_impl(const char *p, const char *end, uint64_t &value) {
+  if (end - p < 4 || p[0] != '"' || p[1] != '0' || (p[2] | 0x20) != 'x') {
+    return NULL;
+  }
+  p += 3;
+
+  int n;
+  if (end - p > 16) {
+    n = Decode16(p, value);
+  } else {
+    n = decode_hex_scalar(p, end, value);
+  }
+  if (n == 0 || n > 16 || p + n == end || p[n] != '"') {
+    return NULL;
+  }
+  return p + n + 1;
+}
+
+template<int (*Decode16)(const char *, uint64_t &)>
+static inline __attribute__((always_inline))
+const char * parse_hex_array_impl(const char *p, const char *end, std::vector<uint64_t> &out) {
+  for (;;) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+      p++;
+    }
+    if (p == end || *p != '"') {
+      return p;
+    }
+
+    uint64_t value;
+    if (!(p = parse_hex_string_impl<Decode16>(p, end, value))) {
+      return NULL;
+    }
+    out.push_back(value);
+
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+      p++;
+    }
+    if (p == end || *p != ',') {
+      return p;
+    }
+    p++;
+  }
+}
+
+static inline __attribute__((always_inline)) int decode_hex16_scalar(const char *p, uint64_t &value) {
+  return decode_hex_scalar(p, p + 16, value);
+}
+
+static const char * parse_hex_string_scalar(const char *p, const char *end, uint64_t &value) {
+  return parse_hex_string_impl<decode_hex16_scalar>(p, end, value);
+}
+
+static const char * parse_hex_array_scalar(const char *p, const char *end, std::vector<uint64_t> &out) {
+  return parse_hex_array_impl<decode_hex16_scalar>(p, end, out);
+}
+
+#ifdef HARB_SCAN_X86
+
+///////////////////////////////////////////////////////////////////////////////
+// SSE2
+///////////////////////////////////////////////////////////////////////////////
+
+static const char * find_newline_sse2(const char *p, const char *end) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return find_newline_scalar(p, end);
+}
+
+static const char * find_quote_or_backslash_sse2(const char *p, const char *end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return find_quote_or_backslash_tail(p, end);
+}
+
+// Converts 16 ASCII bytes to nibbles, finds the length of the leading run of
+// hex digits, then packs the nibbles pairwise into bytes and shifts off
+// everything after the run. Addresses are at most 16 digits, so one address
+// fits a 128-bit register and wider vectors don't buy anything here.
+static inline __attribute__((always_inline)) int decode_hex16_sse2(const char *p, uint64_t &value) {
+  __m128i v = _mm_loadu_si128((const __m128i *) p);
+
+  __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+  __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+  __m128i alpha = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+  __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+
+  unsigned hex_mask = _mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha));
+  int n = __builtin_ctz(~hex_mask);
+  if (n == 0) {
+    return 0;
+  }
+
+  __m128i nibbles = _mm_or_si128(_mm_and_si128(is_digit, digit),
+      _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+  __m128i hi = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0xff)), 4);
+  __m128i lo = _mm_srli_epi16(nibbles, 8);
+  __m128i packed = _mm_packus_epi16(_mm_or_si128(hi, lo), _mm_setzero_si128());
+
+  uint64_t bits = __builtin_bswap64((uint64_t) _mm_cvtsi128_si64(packed));
+  value = bits >> (4 * (16 - n));
+  return n;
+}
+
+static const char * parse_hex_string_sse2(const char *p, const char *end, uint64_t &value) {
+  return parse_hex_string_impl<decode_hex16_sse2>(p, end, value);
+}
+
+static const char * parse_hex_array_sse2(const char *p, const char *end, std::vector<uint64_t> &out) {
+  return parse_hex_array_impl<decode_hex16_sse2>(p, end, out);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2
+///////////////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx2")))
+static const char * find_newline_avx2(const char *p, const char *end) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return find_newline_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char * find_quote_or_backslash_avx2(const char *p, const char *end) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+          _mm256_cmpeq_epi8(v, backslash)));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return find_quote_or_backslash_tail(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char * parse_hex_string_avx2(const char *p, const char *end, uint64_t &value) {
+  return parse_hex_string_impl<decode_hex16_sse2>(p, end, value);
+}
+
+__attribute__((target("avx2")))
+static const char * parse_hex_array_avx2(const char *p, const char *end, std::vector<uint64_t> &out) {
+  return parse_hex_array_impl<decode_hex16_sse2>(p, end, out);
+}
+
+#endif // HARB_SCAN_X86
+
+static const Kernels kAllKernels[] = {
+#ifdef HARB_SCAN_X86
+  { "avx2", find_newline_avx2, find_quote_or_backslash_avx2, parse_hex_string_avx2, parse_hex_array_avx2 },
+  { "sse2", find_newline_sse2, find_quote_or_backslash_sse2, parse_hex_string_sse2, parse_hex_array_sse2 },
+#endif
+  { "scalar", find_newline_scalar, find_quote_or_backslash_scalar, parse_hex_string_scalar, parse_hex_array_scalar }
+};
+
+static bool isa_supported(const char *name) {
+#ifdef HARB_SCAN_X86
+  if (strcmp(name, "avx2") == 0) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }
+  if (strcmp(name, "sse2") == 0) {
+    return true;
+  }
+#endif
+  return strcmp(name, "scalar") == 0;
+}
+
+static Kernels select_kernels() {
+  for (auto &k : kAllKernels) {
+    if (isa_supported(k.name)) {
+      return k;
+    }
+  }
+  return kAllKernels[sizeof(kAllKernels) / sizeof(kAllKernels[0]) - 1];
+}
+
+Kernels kernels_ = select_kernels();
+
+bool select_isa(const char *name) {
+  for (auto &k : kAllKernels) {
+    if (strcmp(k.name, name) == 0 && isa_supported(name)) {
+      kernels_ = k;
+      return true;
+    }
+  }
+  return false;
+}
+
+}
+}
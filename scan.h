@@ -0,0 +1,62 @@
+#ifndef HARB_SCAN_H
+#define HARB_SCAN_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <vector>
+
+namespace harb {
+
+// Byte scanning and hex decoding kernels used by the parser's fast path.
+// The implementation is picked once at startup from what the CPU supports
+// (AVX2, SSE2, or portable scalar code).
+namespace scan {
+
+struct Kernels {
+  const char *name;
+  const char * (*find_newline)(const char *p, const char *end);
+  const char * (*find_quote_or_backslash)(const char *p, const char *end);
+  const char * (*parse_hex_string)(const char *p, const char *end, uint64_t &value);
+  const char * (*parse_hex_array)(const char *p, const char *end, std::vector<uint64_t> &out);
+};
+
+extern Kernels kernels_;
+
+// Returns the name of the kernels in use.
+inline const char * isa() { return kernels_.name; }
+
+// Forces a particular set of kernels ("avx2", "sse2" or "scalar"). Returns
+// false if they aren't available on this machine.
+bool select_isa(const char *name);
+
+// Returns a pointer to the first '\n' in [p, end), or end.
+inline const char * find_newline(const char *p, const char *end) {
+  return kernels_.find_newline(p, end);
+}
+
+// Returns a pointer to the first '"' or '\\' in [p, end), or end.
+inline const char * find_quote_or_backslash(const char *p, const char *end) {
+  return kernels_.find_quote_or_backslash(p, end);
+}
+
+// Decodes a "0x..." string starting at p (which must point at the opening
+// quote). Returns a pointer just past the closing quote, or NULL if it isn't
+// a hex address of at most 16 digits.
+inline const char * parse_hex_string(const char *p, const char *end, uint64_t &value) {
+  return kernels_.parse_hex_string(p, end, value);
+}
+
+// Decodes a comma separated run of "0x..." strings (the body of a
+// "references" array) appending each to out. Returns a pointer to the first
+// character after the run, which is ']' for a well formed array, or NULL if
+// an element isn't a valid address.
+inline const char * parse_hex_array(const char *p, const char *end, std::vector<uint64_t> &out) {
+  return kernels_.parse_hex_array(p, end, out);
+}
+
+}
+
+}
+
+#endif // HARB_SCAN_H
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <vector>
+
+#include "snapshot.h"
+#include "graph.h"
+#include "progress.h"
+
+namespace harb {
+
+static const char kMagic[8] = { 'H', 'A', 'R', 'B', 'S', 'N', 'A', 'P' };
+
+// Size of each of the blocks hashed to tell whether a dump has changed.
+static const size_t kHashBlockSize = 64 * 1024;
+
+Snapshot::Snapshot(const char *data, size_t size)
+  : data_(data), size_(size), header_((const Header *) data) {}
+
+Snapshot::~Snapshot() {
+  munmap((void *) data_, size_);
+}
+
+std::string Snapshot::path_for(const char *dump_path) {
+  return std::string(dump_path) + ".harb";
+}
+
+// Identifies the dump by size, mtime and a hash of its first, middle and
+// last blocks; hashing the whole thing would cost about as much as parsing
+// it.
+bool Snapshot::fill_dump_header(FILE *dump, Header &header) {
+  struct stat st;
+  if (fstat(fileno(dump), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+
+  header.dump_size = st.st_size;
+  header.dump_mtime = st.st_mtime;
+
+  uint64_t h = 0xcbf29ce484222325ULL;
+  std::vector<char> buf(kHashBlockSize);
+  off_t blocks[] = { 0, (off_t) (st.st_size / 2), (off_t) (st.st_size > (off_t) kHashBlockSize ? st.st_size - kHashBlockSize : 0) };
+  for (auto offset : blocks) {
+    ssize_t n = pread(fileno(dump), buf.data(), buf.size(), offset);
+    if (n < 0) {
+      return false;
+    }
+    for (ssize_t i = 0; i < n; ++i) {
+      h = (h ^ (unsigned char) buf[i]) * 0x100000001b3ULL;
+    }
+  }
+  header.dump_hash = h;
+  return true;
+}
+
+// The size in bytes the header's counts call for, or 0 for kStrings, which
+// only needs to be NUL terminated.
+uint64_t Snapshot::section_size(const Header &header, Section s) {
+  uint64_t n = header.num_objects;
+  switch (s) {
+    case kAddr:
+    case kMemsize:
+    case kValue:
+    case kFile:
+    case kMethod:
+    case kRetainedSize:
+      return (n + 1) * sizeof(uint64_t);
+    case kFlags:
+    case kClass:
+    case kSize:
+    case kLine:
+    case kGeneration:
+    case kIdom:
+    case kRetainedCount:
+      return (n + 1) * sizeof(uint32_t);
+    case kRefsToOffsets:
+    case kRefsFromOffsets:
+      return (n + 2) * sizeof(uint64_t);
+    case kDomChildOffsets:
+      return (n + 2) * sizeof(uint32_t);
+    case kRefsTo:
+      return header.num_edges * sizeof(uint32_t);
+    case kRefsFrom:
+      return header.num_inverse_edges * sizeof(uint32_t);
+    case kDfsOrder:
+      return (header.num_reachable + 1) * sizeof(uint32_t);
+    case kDomChildren:
+      return (header.num_reachable - 1) * sizeof(uint32_t);
+    default:
+      return 0;
+  }
+}
+
+Snapshot * Snapshot::open(const char *dump_path, FILE *dump) {
+  Header expected;
+  if (!fill_dump_header(dump, expected)) {
+    return NULL;
+  }
+
+  std::string path = path_for(dump_path);
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(Header)) {
+    close(fd);
+    return NULL;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+
+  Snapshot *snapshot = new Snapshot((const char *) p, st.st_size);
+  const Header *h = snapshot->header_;
+  bool valid = memcmp(h->magic, kMagic, sizeof(kMagic)) == 0 &&
+    h->version == kVersion &&
+    h->header_size == sizeof(Header) &&
+    h->dump_size == expected.dump_size &&
+    h->dump_mtime == expected.dump_mtime &&
+    h->dump_hash == expected.dump_hash;
+  // Sections must lie inside the file, be aligned and be as long as the
+  // header's counts say, so a truncated or mismatched snapshot is parsed
+  // again rather than read out of bounds.
+  valid = valid && h->num_objects > 0 && h->num_objects < UINT32_MAX &&
+    h->num_reachable > 0 && h->num_reachable <= h->num_objects;
+  for (int i = 0; valid && i < kNumSections; ++i) {
+    Section s = (Section) i;
+    valid = h->offsets[i] <= (uint64_t) st.st_size && h->sizes[i] <= st.st_size - h->offsets[i] &&
+      h->offsets[i] % 8 == 0 && (s == kStrings || h->sizes[i] == section_size(*h, s));
+  }
+  valid = valid && h->sizes[kStrings] > 0 &&
+    snapshot->section<char>(kStrings)[h->sizes[kStrings] - 1] == '\0' &&
+    snapshot->section<uint64_t>(kRefsToOffsets)[h->num_objects + 1] == h->num_edges &&
+    snapshot->section<uint64_t>(kRefsFromOffsets)[h->num_objects + 1] == h->num_inverse_edges;
+  if (!valid) {
+    delete snapshot;
+    return NULL;
+  }
+  return snapshot;
+}
+
+namespace {
+
+// Writes sections sequentially, padding each to 8 bytes so the arrays are
+// aligned once mapped.
+class SectionWriter {
+  FILE *f_;
+  Snapshot::Header &header_;
+  uint64_t pos_;
+  bool ok_;
+
+public:
+  SectionWriter(FILE *f, Snapshot::Header &header)
+    : f_(f), header_(header), pos_(sizeof(header)), ok_(true) {
+    fseeko(f_, pos_, SEEK_SET);
+  }
+
+  bool ok() { return ok_; }
+
+  template<typename T> void write_column(Snapshot::Section s, const Column<T> &column) {
+    write_bytes(s, (const char *) column.data(), column.size() * sizeof(T));
+  }
+
+  void write_bytes(Snapshot::Section s, const char *data, size_t size) {
+    header_.offsets[s] = pos_;
+    ok_ = ok_ && fwrite(data, 1, size, f_) == size;
+    header_.sizes[s] = size;
+    pos_ += size;
+    pad();
+  }
+
+  void pad() {
+    static const char zero[8] = { 0 };
+    size_t n = (8 - pos_ % 8) % 8;
+    ok_ = ok_ && fwrite(zero, 1, n, f_) == n;
+    pos_ += n;
+  }
+};
+
+}
+
+bool Snapshot::write(const char *dump_path, FILE *dump, Graph *graph) {
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.header_size = sizeof(Header);
+  if (!fill_dump_header(dump, header)) {
+    return false;
+  }
+
+  std::string path = path_for(dump_path);
+  std::string tmp_path = path + ".tmp";
+  FILE *f = fopen(tmp_path.c_str(), "w");
+  if (!f) {
+    return false;
+  }
+
+  size_t n = graph->num_objects_;
+  ObjectStore &store = graph->store_;
+  DominatorTree *tree = graph->dominator_tree_;
+
+  Progress progress("writing snapshot", 2);
+  progress.start();
+
+  // The object store's columns and the dominator tree's arrays are already
+  // laid out the way they're mapped.
+  SectionWriter w(f, header);
+  w.write_column(kAddr, store.get_addrs());
+  w.write_column(kFlags, store.get_flags());
+  w.write_column(kClass, store.get_classes());
+  w.write_column(kMemsize, store.get_memsizes());
+  w.write_column(kValue, store.get_values());
+  w.write_column(kSize, store.get_sizes());
+  w.write_column(kFile, store.get_files());
+  w.write_column(kLine, store.get_lines());
+  w.write_column(kMethod, store.get_methods());
+  w.write_column(kGeneration, store.get_generations());
+  w.write_column(kRefsToOffsets, store.get_refs_to_offsets());
+  w.write_column(kRefsTo, store.get_refs_to());
+  w.write_column(kRefsFromOffsets, store.get_refs_from_offsets());
+  w.write_column(kRefsFrom, store.get_refs_from());
+  header.num_edges = store.get_refs_to().size();
+  header.num_inverse_edges = store.get_refs_from().size();
+  progress.increment();
+
+  size_t num_reachable = tree->get_num_reachable();
+  header.num_objects = n;
+  header.num_reachable = num_reachable;
+  w.write_bytes(kIdom, (const char *) tree->get_idoms(), (n + 1) * sizeof(uint32_t));
+  w.write_bytes(kDfsOrder, (const char *) tree->get_order(), (num_reachable + 1) * sizeof(uint32_t));
+  w.write_bytes(kDomChildOffsets, (const char *) tree->get_child_offsets(), (n + 2) * sizeof(uint32_t));
+  w.write_bytes(kDomChildren, (const char *) tree->get_children(), (num_reachable - 1) * sizeof(uint32_t));
+  w.write_bytes(kRetainedSize, (const char *) tree->get_retained_sizes(), (n + 1) * sizeof(uint64_t));
+  w.write_bytes(kRetainedCount, (const char *) tree->get_retained_counts(), (n + 1) * sizeof(uint32_t));
+  w.write_bytes(kStrings, store.strings().data(), store.strings().size());
+
+  bool ok = w.ok() && fseeko(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    progress.clear();
+    return false;
+  }
+
+  progress.complete();
+  return true;
+}
+
+}
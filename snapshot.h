@@ -0,0 +1,97 @@
+#ifndef HARB_SNAPSHOT_H
+#define HARB_SNAPSHOT_H
+
+#include <inttypes.h>
+#include <cstdio>
+
+#include <string>
+
+namespace harb {
+
+class Graph;
+
+// A binary image of a fully loaded graph (objects, references in both
+// directions, interned strings and the dominator tree) written next to the
+// dump as <dump>.harb. It is keyed on the dump's size, mtime and a hash of a
+// few sampled blocks, and is mapped directly on later runs instead of
+// re-parsing the dump.
+//
+// The per-object sections are the ObjectStore's columns written out as they
+// are, so a loaded graph uses them in place. Edges are stored in compressed
+// sparse row form: an offsets array with num_objects + 2 entries and a
+// target index array; the root's references are its root children.
+class Snapshot {
+public:
+  static const uint32_t kVersion = 5;
+
+  enum Section {
+    kAddr = 0,       // uint64_t[num_objects + 1]
+    kFlags,          // uint32_t[num_objects + 1], 0 for unused indices
+    kClass,          // uint32_t[num_objects + 1], node index of the class
+    kMemsize,        // uint64_t[num_objects + 1]
+    kValue,          // uint64_t[num_objects + 1], offset into kStrings, 0 for none; root name for roots
+    kSize,           // uint32_t[num_objects + 1]
+    kFile,           // uint64_t[num_objects + 1], offset into kStrings of the allocating file, 0 for none
+    kLine,           // uint32_t[num_objects + 1]
+    kMethod,         // uint64_t[num_objects + 1], offset into kStrings, 0 for none
+    kGeneration,     // uint32_t[num_objects + 1], GC count at allocation
+    kRefsToOffsets,  // uint64_t[num_objects + 2]
+    kRefsTo,         // uint32_t[num_edges]
+    kRefsFromOffsets,// uint64_t[num_objects + 2]
+    kRefsFrom,       // uint32_t[num_inverse_edges]
+    kIdom,           // uint32_t[num_objects + 1], 0 for the root and unreachable nodes
+    kDfsOrder,       // uint32_t[num_reachable + 1], dominator DFS preorder, 1-based
+    kDomChildOffsets,// uint32_t[num_objects + 2]
+    kDomChildren,    // uint32_t[num_reachable - 1], by retained size within each row
+    kRetainedSize,   // uint64_t[num_objects + 1]
+    kRetainedCount,  // uint32_t[num_objects + 1]
+    kStrings,        // NUL terminated strings, starting with an empty one
+    kNumSections
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t dump_size;
+    int64_t dump_mtime;
+    uint64_t dump_hash;
+    uint64_t num_objects;
+    uint64_t num_reachable;
+    uint64_t num_edges;
+    uint64_t num_inverse_edges;
+    uint64_t offsets[kNumSections];
+    uint64_t sizes[kNumSections];
+  };
+
+  ~Snapshot();
+
+  // Maps the snapshot for the given dump, returning NULL if there isn't one
+  // or it doesn't match the dump.
+  static Snapshot * open(const char *dump_path, FILE *dump);
+
+  // Writes a snapshot of graph for the given dump.
+  static bool write(const char *dump_path, FILE *dump, Graph *graph);
+
+  static std::string path_for(const char *dump_path);
+
+  const Header * header() { return header_; }
+
+  template<typename T> const T * section(Section s) {
+    return (const T *) (data_ + header_->offsets[s]);
+  }
+
+private:
+  const char *data_;
+  size_t size_;
+  const Header *header_;
+
+  Snapshot(const char *data, size_t size);
+
+  static bool fill_dump_header(FILE *dump, Header &header);
+  static uint64_t section_size(const Header &header, Section s);
+};
+
+}
+
+#endif // HARB_SNAPSHOT_H